@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////
+#include "Arduino.h"
+#include "Health.h"
+
+#if HEALTH_MONITOR
+
+#define HEALTH_PAINT 0xC5   // pattern painted over unused RAM at boot
+
+extern unsigned char __heap_start;  // end of static data (from the linker)
+extern char *__brkval;              // top of the heap (0 if nothing allocated)
+
+volatile unsigned int healthISRMax;
+unsigned int healthRunMax;
+unsigned int healthOverruns;
+
+static unsigned int healthLastFrame;  // Timer0 overflows at the last pass of the main loop
+static byte healthStarted;            // set once the main loop has made a pass
+
+////////////////////////////////////////////////////////
+// Paint all the RAM between static data and the stack 
+// before anything else runs. This runs from .init3, once
+// the stack pointer is set up but before the C runtime 
+// has started, so it must not use the stack
+void healthPaintStack(void) __attribute__ ((naked, used, section(".init3")));
+void healthPaintStack(void)
+{
+  unsigned char *p = &__heap_start;
+  while(p < (unsigned char*)SP)
+    *p++ = HEALTH_PAINT;
+}
+
+////////////////////////////////////////////////////////
+static unsigned char *heapTop()
+{
+  return __brkval? (unsigned char*)__brkval : &__heap_start;
+}
+
+////////////////////////////////////////////////////////
+void CHealth::init()
+{
+  // free running Timer1, clock/8
+  TCCR1A = 0;
+  TCCR1B = 1<<CS11;
+  reset();
+}
+
+////////////////////////////////////////////////////////
+// Clear the worst case figures
+void CHealth::reset()
+{
+  noInterrupts();
+  healthISRMax = 0;
+  interrupts();
+  healthRunMax = 0;
+  healthOverruns = 0;
+}
+
+////////////////////////////////////////////////////////
+// Called on every pass of the main loop. Timer0 overflows
+// every 1.024ms, once per new millis() value, and 
+// micros()/1024 is its exact overflow count. Each overflow
+// that went by between two passes is a millisecond the main
+// loop missed. (millis() itself can't show this, as it 
+// steps by 2 every ~42ms to correct its own drift)
+void CHealth::pass()
+{
+  unsigned int frame = (micros() >> 10) & 0xFFFF;
+  unsigned int elapsed = (frame - healthLastFrame) & 0xFFFF;
+  if(healthStarted && elapsed > 1)
+    healthOverruns += elapsed - 1;
+  healthLastFrame = frame;
+  healthStarted = 1;
+}
+
+////////////////////////////////////////////////////////
+// Bytes currently free between the heap and the stack
+unsigned int CHealth::freeRAM()
+{
+  return (unsigned char*)SP - heapTop();
+}
+
+////////////////////////////////////////////////////////
+// Bytes above the heap that the stack has never reached
+unsigned int CHealth::stackHeadroom()
+{
+  unsigned char *p = heapTop();
+  unsigned int count = 0;
+  while(p < (unsigned char*)SP && *p++ == HEALTH_PAINT)
+    ++count;
+  return count;
+}
+
+////////////////////////////////////////////////////////
+unsigned int CHealth::isrMaxMicros()
+{
+  noInterrupts();
+  unsigned int t = healthISRMax;
+  interrupts();
+  return t/2;
+}
+
+////////////////////////////////////////////////////////
+unsigned int CHealth::runMaxMicros()
+{
+  return healthRunMax/2;
+}
+
+#endif
@@ -0,0 +1,48 @@
+////////////////////////////////////////////////////////
+//
+// H E A L T H   M O N I T O R
+//
+// Keeps an eye on how close the firmware runs to its
+// limits: free RAM, how deep the stack has ever reached,
+// the worst case time spent in the display interrupt 
+// and in the tick engine, and how often the main loop
+// fell behind the millisecond timer
+//
+// Set HEALTH_MONITOR to 0 to build without it
+//
+////////////////////////////////////////////////////////
+
+#define HEALTH_MONITOR 1
+
+#if HEALTH_MONITOR
+
+// Timer1 free runs at 2MHz (0.5us per count) while the
+// monitor is enabled, so pins 9 and 10 can't do PWM. A
+// section timed with these macros must take under 32ms
+#define HEALTH_TIMER_START()    unsigned int healthTimerStart = TCNT1
+#define HEALTH_TIMER_END(worst) { unsigned int t = TCNT1 - healthTimerStart; if(t > (worst)) (worst) = t; }
+#define HEALTH_PASS()           CHealth::pass()
+
+extern volatile unsigned int healthISRMax;  // Timer1 counts
+extern unsigned int healthRunMax;           // Timer1 counts
+extern unsigned int healthOverruns;         // milliseconds the main loop missed
+
+class CHealth
+{
+public:
+  static void init();
+  static void reset();
+  static void pass();
+  static unsigned int freeRAM();
+  static unsigned int stackHeadroom();
+  static unsigned int isrMaxMicros();
+  static unsigned int runMaxMicros();
+};
+
+#else
+
+#define HEALTH_TIMER_START()
+#define HEALTH_TIMER_END(worst)
+#define HEALTH_PASS()
+
+#endif
@@ -20,6 +20,7 @@ enum {
   MUTATOR_NULL,
   MUTATOR_SHUFFLE,
   MUTATOR_RANDOM,
+  MUTATOR_CHANCE,
   MUTATOR_MAX
 };
 
@@ -118,5 +119,106 @@ public:
   }
 };
 
+/////////////////////////////////////////////////////////////
+// CHANCE
+// Straight beat where each step plays with a given probability,
+// and sometimes plays as a ratchet (a burst of quicker pulses 
+// within the step). A nonzero seed repeats the same choices
+// every loop, zero makes new choices each time
+class CChanceMutator : public CMutator
+{
+  int Probability;
+  int Ratchets;
+  int RatchetChance;
+  int Seed;
+  unsigned int state;
+  
+  // 16 bit xorshift generator.. returns a percentage 0-99
+  byte chance()
+  {
+    state = (state ^ (state << 7)) & 0xFFFF;
+    state ^= state >> 9;
+    state = (state ^ (state << 8)) & 0xFFFF;
+    return ((unsigned long)state * 100) >> 16;
+  }
+public: 
+  CChanceMutator() 
+  {
+    Probability = 100;
+    Ratchets = 2;
+    RatchetChance = 25;
+    Seed = 1;
+    state = 1;
+  }
+  void getName(byte *buf) 
+  { 
+      // Prb
+      buf[0] = DGT_P;
+      buf[1] = DGT_R;
+      buf[2] = DGT_B;
+  }
+  int getStepTime(int s)
+  {
+    return TICKS_PER_STEP * s;
+  }
+  void beginLoop()
+  {
+    if(Seed) 
+      state = Seed;
+  }
+  byte getStepPulses(int s)
+  {
+    if(chance() >= Probability)
+      return 0;
+    if(chance() < RatchetChance)
+      return Ratchets;
+    return 1;
+  }
+  int getNumParams() { return 4; }
+  int getParam(int index) 
+  { 
+    switch(index)
+    {
+    case 0: return Probability;
+    case 1: return Ratchets;
+    case 2: return RatchetChance;
+    default: return Seed;
+    }
+  }
+  int setParam(int index, int value) 
+  { 
+    switch(index)
+    {
+    case 0: 
+      Probability = constrain(value, 0, 100); 
+      return Probability;
+    case 1: 
+      Ratchets = constrain(value, 1, 8); 
+      return Ratchets;
+    case 2: 
+      RatchetChance = constrain(value, 0, 100); 
+      return RatchetChance;
+    default: 
+      Seed = constrain(value, 0, 999); 
+      return Seed;
+    }
+  }
+};
 
-
+/////////////////////////////////////////////////////////////
+// Create a mutator.. hook up new mutators here
+inline CMutator *createMutator(byte which)
+{
+  switch(which)
+  {
+  case MUTATOR_NULL:    
+    return new CNullMutator; 
+  case MUTATOR_SHUFFLE: 
+    return new CShuffleMutator;
+  case MUTATOR_RANDOM:  
+    return new CRandomMutator;
+  case MUTATOR_CHANCE:  
+    return new CChanceMutator;
+  }  
+  return new CNullMutator; 
+}
@@ -4,15 +4,29 @@
 //
 ////////////////////////////////////////////////////////
 
+// A loop is played from a trigger plan, a ring of triggers
+// filled from the main loop by plan(), one step at a time, by
+// asking the mutator for the time and number of pulses of
+// each step. Each trigger is packed as a 12 bit tick offset
+// into the loop and a 4 bit pulse count, with the spacing of
+// ratchet pulses held alongside. An entry with no pulses marks
+// the start of a loop; the next loop is begun during the last
+// step of the one playing, so tick() only has to walk the ring
+#define PLAN_MAX          MAX_STEPS
+#define PLAN_TIME_MASK    0x0FFF
+#define PLAN_PULSE_SHIFT  12
+#define PLAN_PULSE_MAX    15
+
 class CSynchChannel
 {
 
   byte outputPin;            // Arduino digital pin on which the pulse is sent
   byte activeSteps;          // Total number of steps used before repeating sequence
   byte divider;
-  byte pulseTime;            // milliseconds for the output pulse
+  byte pulseTime;            // length of the output pulse (units depend on gateMode)
   byte pulseRecoverTime;     // minimum milliseconds between pulses
   byte invert;               // output is LOW during tick if set (NB: output is electrically inverted at the buffer)
+  byte gateMode;             // how pulseTime is measured
   byte mutator;
   CMutator *pMutator[MUTATOR_MAX];
   
@@ -20,14 +34,31 @@ class CSynchChannel
     STATE_READY,   
     STATE_PULSE,
     STATE_PULSING,
+    STATE_GATE_END,
     STATE_RECOVER    
   };
   
-  byte currentStep;
   int tickCount;
-  int nextStepTime;
   unsigned long stateEndTime;
   byte state;
+
+  unsigned long tickPeriod;  // milliseconds per tick (16.16)
+  byte cycleTicks;           // fewest ticks taken by a pulse and its recovery
+  byte pulseTicks;           // whole ticks taken by a pulse in milliseconds
+  byte recoverTicks;         // whole ticks taken by the recovery time
+  int gateTicksLeft;         // ticks until the pulse is ended (0 = timed in ms)
+  
+  unsigned int planTrigger[PLAN_MAX];  // tick offset and pulse count of each trigger
+  byte planSpacing[PLAN_MAX];          // ticks between ratchet pulses, or to the next step
+  byte planRead;             // next trigger to play
+  byte planCount;            // number of triggers in the ring
+  byte planLoops;            // loop start markers in the ring
+  byte planStep;             // first step not yet planned
+  int planStepTime;          // time of that step
+  int planSkip;              // steps before this tick were passed over by restart()
+  int triggerTime;           // tick offset of the next pulse
+  byte triggerSpacing;       
+  byte pulsesLeft;           // pulses left to play from the current trigger
   
 public: 
   enum 
@@ -37,7 +68,16 @@ public:
     PARAM_DIV,        
     PARAM_PULSEMS,        
     PARAM_RECOVERMS,        
-    PARAM_INVERT        
+    PARAM_INVERT,
+    PARAM_GATEMODE
+  };
+
+  enum 
+  {
+    GATE_MS,      // pulseTime is in milliseconds
+    GATE_STEP,    // pulseTime is a percentage of the step
+    GATE_TICKS,   // pulseTime is in ticks
+    GATE_MAX
   };
   
   ////////////////////////////////////////////////////////
@@ -47,6 +87,13 @@ public:
     pulseTime = 15;           
     pulseRecoverTime = 10;
     activeSteps = 16;    
+    divider = 1;
+    gateMode = GATE_MS;
+    tickPeriod = 0;
+    cycleTicks = 1;
+    pulseTicks = 1;
+    recoverTicks = 1;
+    mutator = 0;
 
     // create the mutators
     // TODO: Load the config    
@@ -83,13 +130,19 @@ public:
       return divider;
     case PARAM_PULSEMS:
       pulseTime = constrain(value,1,99);
+      setTickPeriod(tickPeriod);
       return pulseTime;
     case PARAM_RECOVERMS:
       pulseRecoverTime = constrain(value,1,99);
+      setTickPeriod(tickPeriod);
       return pulseRecoverTime;    
     case PARAM_INVERT:        
       invert = constrain(value,0,1);
       return invert;    
+    case PARAM_GATEMODE:        
+      gateMode = constrain(value,0,GATE_MAX-1);
+      setTickPeriod(tickPeriod);
+      return gateMode;    
     default:
       return 0;    
     }
@@ -112,6 +165,8 @@ public:
       return pulseRecoverTime;    
     case PARAM_INVERT:        
       return invert;    
+    case PARAM_GATEMODE:        
+      return gateMode;    
     default:
       return 0;    
     }
@@ -126,15 +181,210 @@ public:
       return setParam(which, getParam(which)-1);
   }
 
+  ////////////////////////////////////////////////////////
+  // Pack the mutation, its parameters, the steps and the 
+  // divider into PATTERN_CHAN_SIZE bytes:
+  //
+  // 0      mutator
+  // 1      steps
+  // 2      divider
+  // 3..7   four 10 bit mutator parameters
+  void pack(byte *buf)
+  {
+    CMutator *m = pMutator[mutator];
+    memset(buf, 0, PATTERN_CHAN_SIZE);
+    buf[0] = mutator;
+    buf[1] = activeSteps;
+    buf[2] = divider;
+    for(int i = 0; i < m->getNumParams() && i < MUTATOR_PARAMS_MAX; ++i)
+    {
+      byte bit = 10 * i;
+      unsigned int v = (m->getParam(i) & 0x3FF) << (bit%8);
+      buf[3 + bit/8] |= (byte)v;
+      buf[4 + bit/8] |= (byte)(v>>8);
+    }
+  }
+
+  ////////////////////////////////////////////////////////
+  // Load settings packed by pack(). Only sets up values, so 
+  // it is cheap enough to call at a loop boundary
+  void unpack(const byte *buf)
+  {
+    setParam(PARAM_MUTATION, buf[0]);
+    setParam(PARAM_STEPS, buf[1]);
+    setParam(PARAM_DIV, buf[2]);
+    CMutator *m = pMutator[mutator];
+    for(int i = 0; i < m->getNumParams() && i < MUTATOR_PARAMS_MAX; ++i)
+    {
+      byte bit = 10 * i;
+      unsigned int v = (buf[3 + bit/8] | ((unsigned int)buf[4 + bit/8]<<8)) >> (bit%8);
+      m->setParam(i, v & 0x3FF);
+    }
+  }
+
   ////////////////////////////////////////////////////////
   void reset()
   {
-    currentStep = 0;
-    tickCount = 0;
-    nextStepTime = 0;
+    restart();
     stateEndTime = 0;
     state = STATE_READY;
   }      
+
+  ////////////////////////////////////////////////////////
+  // Go back to a tick position in the loop (the first step
+  // by default), leaving any pulse in progress to finish 
+  // normally. The position is taken modulo the loop length,
+  // so units counting the same ticks play the same steps.
+  // Steps already passed are caught up by plan()
+  void restart(unsigned long position = 0)
+  {
+    tickCount = position % (TICKS_PER_STEP * activeSteps);
+    planRead = 0;
+    planCount = 0;
+    planLoops = 0;
+    pulsesLeft = 0;
+    gateTicksLeft = 0;
+    startLoop();
+    if(tickCount)
+    {
+      // part way through the loop.. drop the start marker
+      planCount = 0;
+      planLoops = 0;
+      planSkip = tickCount;
+    }
+  }
+
+  ////////////////////////////////////////////////////////
+  // Called by the tick engine when the tempo changes, to work
+  // out how many ticks a pulse and its recovery take up, so
+  // that the tick engine can keep pulses apart without any
+  // further division
+  void setTickPeriod(unsigned long period)
+  {
+    tickPeriod = period;
+    if(!period)
+      return;
+    // allow an extra 2ms as the pulse state machine only 
+    // moves on once the time has passed
+    pulseTicks = msToTicks(pulseTime + 2, period);
+    recoverTicks = msToTicks(pulseRecoverTime + 2, period);
+    unsigned int cycle;
+    switch(gateMode)
+    {
+    case GATE_STEP:  
+      cycle = 1 + recoverTicks; // the pulse shrinks to fit
+      break;
+    case GATE_TICKS: 
+      cycle = pulseTime + recoverTicks;
+      break;
+    default:         
+      // a ratchet can start a millisecond after its tick, and
+      // the tick after the recovery can come in the same 
+      // millisecond the channel is ready, but ahead of run()
+      cycle = msToTicks(pulseTime + pulseRecoverTime + 3, period);
+      break;
+    }
+    cycleTicks = min(cycle, 255);
+  }
+
+  ////////////////////////////////////////////////////////
+  // Whole ticks covering a number of milliseconds
+  static byte msToTicks(byte ms, unsigned long period)
+  {
+    unsigned long ticks = (((unsigned long)ms << 16) + period - 1) / period;
+    return min(ticks, 255);
+  }
+
+  ////////////////////////////////////////////////////////
+  // Called from the main loop to keep the plan ahead of the
+  // tick engine. Plans at most one step per call, after 
+  // passing over any steps skipped by restart()
+  void plan()
+  {
+    if(planCount >= PLAN_MAX)
+      return;
+    while(planSkip && planStep < activeSteps && planStepTime < planSkip)
+      planNextStep();
+    if(planStep < activeSteps)
+      planNextStep();
+    else if(!planLoops && tickCount >= TICKS_PER_STEP * (activeSteps - 1))
+      startLoop();
+  }
+
+  ////////////////////////////////////////////////////////
+  // Add a trigger to the end of the ring
+  void planPush(unsigned int trigger, byte spacing)
+  {
+    byte i = planRead + planCount;
+    if(i >= PLAN_MAX)
+      i -= PLAN_MAX;
+    planTrigger[i] = trigger;
+    planSpacing[i] = spacing;
+    ++planCount;
+  }
+
+  ////////////////////////////////////////////////////////
+  // Drop the trigger at the front of the ring
+  void planPop()
+  {
+    if(++planRead >= PLAN_MAX)
+      planRead = 0;
+    --planCount;
+  }
+
+  ////////////////////////////////////////////////////////
+  // Begin planning the next loop, marking its start in the ring
+  void startLoop()
+  {
+    CMutator *m = pMutator[mutator];
+    m->beginLoop();
+    planStep = 0;
+    planStepTime = constrain(m->getStepTime(0), 0, PLAN_TIME_MASK);
+    planSkip = 0;
+    planPush(0, 0);
+    ++planLoops;
+  }
+
+  ////////////////////////////////////////////////////////
+  // Add the trigger for the next step to the plan. Ratchets 
+  // are squeezed so that every pulse gets its full recovery
+  // time before the next step is due, and are played as a 
+  // single pulse if there is no room
+  void planNextStep()
+  {
+    CMutator *m = pMutator[mutator];
+    int time = planStepTime;
+    byte pulses = m->getStepPulses(planStep);
+    if(pulses > PLAN_PULSE_MAX)
+      pulses = PLAN_PULSE_MAX;
+    if(++planStep < activeSteps)
+      planStepTime = constrain(m->getStepTime(planStep), 0, PLAN_TIME_MASK);
+    else
+      planStepTime = TICKS_PER_STEP * activeSteps;
+    if(time < planSkip)
+      return;   // passed over, but drawn so the mutator stays in sequence
+    planSkip = 0;
+    if(!pulses)
+      return;
+    
+    int stepTicks = planStepTime - time;
+    byte spacing = constrain(stepTicks, 0, 255);
+    if(pulses > 1)
+    {
+      if(stepTicks < 2 * cycleTicks)
+      {
+        pulses = 1;
+      }
+      else
+      {
+        int room = stepTicks / cycleTicks;
+        pulses = min(pulses, room);
+        room = stepTicks / pulses;
+        spacing = min(room, 255);
+      }
+    }
+    planPush(time | ((unsigned int)pulses << PLAN_PULSE_SHIFT), spacing);
+  }
   
   ////////////////////////////////////////////////////////
   void timerRollover()
@@ -157,12 +407,14 @@ public:
           state = STATE_PULSING;
           break;
       case STATE_PULSING:
-        if(milliseconds > stateEndTime)
-        {
-          digitalWrite(outputPin, !!invert); // end the tick
-          stateEndTime = milliseconds + pulseRecoverTime;
-          state = STATE_RECOVER;
-        }
+        if(GATE_MS != gateMode || milliseconds <= stateEndTime)
+          break;
+        // fall through
+      case STATE_GATE_END:
+        digitalWrite(outputPin, !!invert); // end the tick
+        stateEndTime = milliseconds + pulseRecoverTime;
+        state = STATE_RECOVER;
+        gateTicksLeft = 0;
         break;
       case STATE_RECOVER:
         if(milliseconds > stateEndTime)
@@ -171,27 +423,86 @@ public:
     }          
   }
   
+  ////////////////////////////////////////////////////////  
+  // Work out how many ticks the pulse just started should last.
+  // It is cut short if need be to leave the recovery time before 
+  // the next pulse is due, so that pulses never run together
+  void startGate()
+  {
+    int slot = triggerTime - tickCount; // ticks until the next pulse is due
+    int gate;
+    switch(gateMode)
+    {
+    case GATE_STEP:
+      // ((x + 50) * 167773) >> 24 is x / 100 rounded, exactly
+      // for any x up to 255 * 99, without a division
+      gate = (((unsigned long)triggerSpacing * pulseTime + 50) * 167773UL) >> 24;
+      break;
+    case GATE_TICKS:
+      gate = pulseTime;
+      break;
+    default:
+      gate = pulseTicks;
+      break;
+    }
+    if(gate > slot - recoverTicks)
+      gate = slot - recoverTicks;
+    if(gate < 1)
+      gate = 1;
+    // pulses in milliseconds only need the tick count if they
+    // have to be cut short
+    if(GATE_MS == gateMode && gate == pulseTicks)
+      gate = 0;
+    gateTicksLeft = gate;
+  }
+
   ////////////////////////////////////////////////////////  
   void tick()
   {
+    // pulse timed in ticks? (holds off until the pulse has started)
+    if(gateTicksLeft && STATE_PULSE != state && !--gateTicksLeft && STATE_PULSING == state)
+      state = STATE_GATE_END;
+
+    if(!tickCount)
+    {
+      // start of the loop. Any pulses left over from the end
+      // of the last loop are dropped, along with the rest of
+      // its plan
+      pulsesLeft = 0;
+      if(!planLoops)
+      {
+        // the main loop has not kept up.. start the plan afresh
+        planCount = 0;
+        startLoop();
+      }
+      while(planTrigger[planRead] >> PLAN_PULSE_SHIFT)
+        planPop();
+      planPop();
+      --planLoops;
+    }
+
     if(STATE_READY == state)
     {
-        // After the final step of the loop we are waiting for the last tick
-        // of the loop to pass before returning to the first step
-        if(currentStep < activeSteps && tickCount >= nextStepTime)
-        {
-          state = STATE_PULSE;
-          // skip to next step
-          if(++currentStep < activeSteps)     
-          {
-            nextStepTime = pMutator[mutator]->getStepTime(currentStep);
-          }
-          else
-          {
-            // the next step will be the first of the loop
-            nextStepTime = pMutator[mutator]->getStepTime(0);
-          }
-        }
+      // the main loop has not kept up with a step that is due?
+      if(!pulsesLeft && !planCount && !planLoops && planStep < activeSteps && planStepTime <= tickCount)
+        planNextStep();
+      if(!pulsesLeft && planCount && (planTrigger[planRead] >> PLAN_PULSE_SHIFT))
+      {
+        // move on to the next trigger
+        triggerTime = planTrigger[planRead] & PLAN_TIME_MASK;
+        pulsesLeft = planTrigger[planRead] >> PLAN_PULSE_SHIFT;
+        triggerSpacing = planSpacing[planRead];
+        planPop();
+      }
+      // After the final step of the loop we are waiting for the last tick
+      // of the loop to pass before returning to the first step
+      if(pulsesLeft && tickCount >= triggerTime)
+      {
+        state = STATE_PULSE;
+        triggerTime += triggerSpacing;
+        --pulsesLeft;
+        startGate();
+      }
     }      
     
     // Count the tick
@@ -200,7 +511,6 @@ public:
       // we only return to step 0 at the correct
       // end time of the loop      
       tickCount = 0;
-      currentStep = 0;
     } 
   }
 };
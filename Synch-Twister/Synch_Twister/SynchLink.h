@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////
+//
+// SYNCH LINK
+//
+// Frames sent over the UART to keep several units in
+// step. The leader sends its bar count, its position in the
+// bar and its tick period once per beat, and answers pings from followers, who
+// use the round trip time to allow for the link latency.
+//
+// Like MIDI, a frame starts with a byte with the top bit
+// set followed by 7 bit data bytes, so a receiver picks up
+// again at the next frame if anything is lost
+//
+//  LINK_POSITION  bar count (21 bits), bar tick (14 bits), 
+//                 tick period (28 bits, 16.16 ms)
+//  LINK_PING      time stamp (14 bits, ms)
+//  LINK_PONG      time stamp copied from the ping
+//
+////////////////////////////////////////////////////////
+
+enum {
+  LINK_POSITION = 0x81,
+  LINK_PING     = 0x82,
+  LINK_PONG     = 0x83
+};
+
+#define LINK_POSITION_LEN  10
+#define LINK_PING_LEN      3
+#define LINK_FRAME_MAX     LINK_POSITION_LEN
+#define LINK_BAR_MASK      0x1FFFFFUL
+
+class CSynchLink
+{
+  byte frame[LINK_FRAME_MAX];
+  byte length;        // bytes received of the current frame
+  byte expected;      // total length of the current frame (0 = waiting for a frame)
+
+public:
+  // contents of the last frame received
+  unsigned long bar;
+  unsigned int position;
+  unsigned long period;
+  unsigned int stamp;
+
+  ////////////////////////////////////////////////////////
+  CSynchLink()
+  {
+    expected = 0;
+    length = 0;
+  }
+
+  ////////////////////////////////////////////////////////
+  // Pass in a received byte. Returns the type of frame once
+  // a whole one has arrived, otherwise 0
+  byte receive(byte b)
+  {
+    if(b & 0x80)
+    {
+      switch(b)
+      {
+      case LINK_POSITION: expected = LINK_POSITION_LEN; break;
+      case LINK_PING:
+      case LINK_PONG:     expected = LINK_PING_LEN; break;
+      default:            expected = 0; break;
+      }
+      length = 0;
+    }
+    if(!expected)
+      return 0;
+    frame[length++] = b;
+    if(length < expected)
+      return 0;
+
+    expected = 0;
+    switch(frame[0])
+    {
+    case LINK_POSITION:
+      bar = frame[1] | ((unsigned long)frame[2] << 7) | ((unsigned long)frame[3] << 14);
+      position = frame[4] | ((unsigned int)frame[5] << 7);
+      period = frame[6] | ((unsigned long)frame[7] << 7) | ((unsigned long)frame[8] << 14) | ((unsigned long)frame[9] << 21);
+      break;
+    case LINK_PING:
+    case LINK_PONG:
+      stamp = frame[1] | ((unsigned int)frame[2] << 7);
+      break;
+    }
+    return frame[0];
+  }
+
+  ////////////////////////////////////////////////////////
+  static byte encodePosition(byte *buf, unsigned long bar, unsigned int position, unsigned long period)
+  {
+    buf[0] = LINK_POSITION;
+    buf[1] = bar & 0x7F;
+    buf[2] = (bar >> 7) & 0x7F;
+    buf[3] = (bar >> 14) & 0x7F;
+    buf[4] = position & 0x7F;
+    buf[5] = (position >> 7) & 0x7F;
+    buf[6] = period & 0x7F;
+    buf[7] = (period >> 7) & 0x7F;
+    buf[8] = (period >> 14) & 0x7F;
+    buf[9] = (period >> 21) & 0x7F;
+    return LINK_POSITION_LEN;
+  }
+
+  ////////////////////////////////////////////////////////
+  static byte encodeStamp(byte *buf, byte type, unsigned int stamp)
+  {
+    buf[0] = type;
+    buf[1] = stamp & 0x7F;
+    buf[2] = (stamp >> 7) & 0x7F;
+    return LINK_PING_LEN;
+  }
+};
@@ -18,6 +18,16 @@
 #define MAX_STEPS 32
 #define TICKS_PER_BEAT  96
 #define TICKS_PER_STEP  24
+#define BEATS_PER_BAR   4
+#define TICKS_PER_BAR   (TICKS_PER_BEAT * BEATS_PER_BAR)
+
+// The tick period is held as milliseconds in 16.16 fixed point
+// so that the tick engine and tempo ramps need only integer
+// maths. Dividing this constant by the BPM gives the period
+#define SYNCH_PERIOD_BPM  40960000UL  // ((60000/96) << 16)
+
+// Size of a channel's settings when packed into a pattern
+#define PATTERN_CHAN_SIZE  8
 
 
 class CMutator
@@ -25,6 +35,10 @@ class CMutator
 public:  
   virtual void getName(byte *buf) = 0;
   virtual int getStepTime(int s) = 0;
+  // called at the start of each loop, before its steps are planned
+  virtual void beginLoop() {}
+  // number of pulses on a step.. 0 to skip it, more for a ratchet
+  virtual byte getStepPulses(int s) { return 1; }
   virtual int getNumParams() = 0;
   virtual int getParam(int index) = 0;
   virtual int setParam(int index, int value) = 0;
@@ -5,26 +5,15 @@
 ////////////////////////////////////////////////////////
 
 #include "Arduino.h"
+#include <avr/eeprom.h>
 #include "TinyUI.h"
 #include "Synch_Twister.h"
 #include "Mutators.h"
 #include "SynchChannel.h"
+#include "TapTempo.h"
+#include "Health.h"
+#include "SynchLink.h"
 
-////////////////////////////////////////////////////////
-// Create a mutator.. hook up new mutators here
-CMutator *createMutator(byte which)
-{
-  switch(which)
-  {
-  case MUTATOR_NULL:    
-    return new CNullMutator; 
-  case MUTATOR_SHUFFLE: 
-    return new CShuffleMutator;
-  case MUTATOR_RANDOM:  
-    return new CRandomMutator;
-  }  
-  return new CNullMutator; 
-}
 
 
 
@@ -81,27 +70,178 @@ enum {
   SYNCH_SOURCE_INTERNAL,
   SYNCH_SOURCE_MIDI,
   SYNCH_SOURCE_CV,
+  SYNCH_SOURCE_LINK,
   SYNCH_SOURCE_MAX
 };
+enum {
+  SYNCH_RAMP_LINEAR,
+  SYNCH_RAMP_EXPONENTIAL,
+  SYNCH_RAMP_MAX
+};
+
 CSynchChannel synchChannels[NUM_CHANNELS];
-double synchMillisPerTick; 
-double synchNextTick;
+unsigned long synchTickPeriod;      // milliseconds per tick (16.16)
+unsigned long synchNextTick;        // milliseconds of the next tick (whole part)
+unsigned int synchNextTickFrac;     // milliseconds of the next tick (fraction part)
 double synchBPM;
 unsigned long synchLastMilliseconds;
 byte synchState;
 byte synchSource;
+unsigned int synchBarTick;          // ticks since the start of the bar
+unsigned long synchBar;             // bars counted, up to LINK_BAR_MASK, so linked units agree on loop positions
+byte synchBeatTick;                 // ticks since the start of the beat
+byte synchRealign;                  // set to put the channels in step with the bar count by the next bar
+CTapTempo synchTapTempo;
+
+// Tempo ramp. The period is stepped once per tick until the ramp 
+// ends exactly on the target period after a whole number of beats
+byte synchRampShape;              // shape of the next ramp (set from the menu)
+byte synchRampBeats;              // length of a ramp in beats
+byte synchRampCurve;              // shape of the ramp running, fixed when it starts
+unsigned long synchRampTarget;    // target period
+unsigned int synchRampTicks;      // total ticks in the ramp
+unsigned int synchRampTicksLeft;  // ticks before the ramp ends (0 = no ramp)
+byte synchRampBeatTicks;          // ticks before the channels are next updated
+long synchRampStep;               // linear: whole change in period per tick
+unsigned int synchRampRemainder;  // linear: leftover change, spread over the ramp
+unsigned int synchRampError;      // linear: accumulated leftover change
+char synchRampSign;               // linear: direction of the leftover change
+long synchRampFactor;             // exponential: relative change per tick (8.24)
+unsigned long synchRampFraction;  // exponential: leftover change carried to the next tick (8.24)
+
+// Let the channels know the tick period has changed
+void synchUpdateChannels()
+{
+  for(int i=0;i<NUM_CHANNELS;++i)
+    synchChannels[i].setTickPeriod(synchTickPeriod);
+}
+
+// Keep the channels' trigger plans ahead of the tick engine,
+// from the main loop so that tick() only has to play them
+void synchPlan()
+{
+  for(int i=0;i<NUM_CHANNELS;++i)
+    synchChannels[i].plan();
+}
+
+// Set the tick period, stretching the part of the current tick
+// that has not yet elapsed to the new tempo so the running
+// channels carry on from where they are rather than jumping
+void synchSetPeriod(unsigned long period)
+{
+  if(synchTickPeriod && synchNextTick >= synchLastMilliseconds)
+  {
+    unsigned long remaining = ((synchNextTick - synchLastMilliseconds)<<16) + synchNextTickFrac;
+    remaining = ((unsigned long long)remaining * period) / synchTickPeriod;
+    synchNextTick = synchLastMilliseconds + (remaining >> 16);
+    synchNextTickFrac = remaining & 0xFFFF;
+  }
+  synchTickPeriod = period;
+  synchUpdateChannels();
+}
+
+// Jump straight to a new tempo, cancelling any ramp
 void synchSetBPM(double b)
 {
   synchBPM = b;
-  double millisecondsPerBeat = 60000.0/synchBPM;
-  synchMillisPerTick = millisecondsPerBeat/96.0;
+  synchRampTicksLeft = 0;
+  synchSetPeriod(SYNCH_PERIOD_BPM/synchBPM + 0.5);
+}
+
+// Start a ramp from the current tempo to a new one. All the 
+// division is done here so that the tick engine does not need any
+void synchRampBPM(double b)
+{
+  if(!synchRampBeats)
+  {
+    synchSetBPM(b);
+    return;
+  }
+  synchBPM = b;
+  synchRampTarget = SYNCH_PERIOD_BPM/synchBPM + 0.5;
+  synchRampTicks = synchRampBeats * TICKS_PER_BEAT;  
+  long change = (long)synchRampTarget - (long)synchTickPeriod;
+  synchRampCurve = synchRampShape;
+  switch(synchRampCurve)
+  {
+  case SYNCH_RAMP_LINEAR:
+    synchRampStep = change / (long)synchRampTicks;
+    synchRampRemainder = labs(change % (long)synchRampTicks);
+    synchRampSign = (change < 0)? -1 : 1;
+    synchRampError = 0;
+    break;
+  case SYNCH_RAMP_EXPONENTIAL:
+    synchRampFactor = lround((pow((double)synchRampTarget/synchTickPeriod, 1.0/synchRampTicks) - 1.0) * 16777216.0);
+    synchRampFraction = 0;
+    break;
+  }
+  synchRampTicksLeft = synchRampTicks;
+  synchRampBeatTicks = TICKS_PER_BEAT;
+}
+
+// Step the tempo ramp on by one tick. The channels are told
+// the new period once per beat, to keep division off the tick
+void synchRampTick()
+{
+  if(!--synchRampTicksLeft)
+  {
+    // land exactly on the target
+    synchTickPeriod = synchRampTarget;
+    synchUpdateChannels();
+    return;
+  }
+  if(!--synchRampBeatTicks)
+  {
+    synchRampBeatTicks = TICKS_PER_BEAT;
+    synchUpdateChannels();
+  }
+  switch(synchRampCurve)
+  {
+  case SYNCH_RAMP_LINEAR:
+    synchTickPeriod += synchRampStep;
+    synchRampError += synchRampRemainder;
+    if(synchRampError >= synchRampTicks)
+    {
+      synchRampError -= synchRampTicks;
+      synchTickPeriod += synchRampSign;
+    }
+    break;
+  case SYNCH_RAMP_EXPONENTIAL:
+    {
+      // carry the part of the change too small to apply, so that 
+      // rounding does not build up over a long ramp
+      long long change = (long long)synchTickPeriod * synchRampFactor + synchRampFraction;
+      synchTickPeriod += change >> 24;
+      synchRampFraction = change & 0xFFFFFF;
+    }
+    break;
+  }
+}
+
+// Tap tempo.. the new BPM is applied once enough taps agree
+byte synchTap(unsigned long milliseconds)
+{
+  double bpm;
+  if(synchSource != SYNCH_SOURCE_INTERNAL || !synchTapTempo.tap(milliseconds, &bpm))
+    return 0;
+  synchSetBPM(constrain(bpm, 1, 350));
+  return 1;
 }
 
 void synchInit()
 {
-  synchSetBPM(120);
+  synchTickPeriod = 0;
   synchNextTick = 0;
+  synchNextTickFrac = 0;
   synchLastMilliseconds = 0;
+  synchSetBPM(120);
+  synchRampShape = SYNCH_RAMP_LINEAR;
+  synchRampCurve = SYNCH_RAMP_LINEAR;
+  synchRampBeats = 4;
+  synchBarTick = 0;
+  synchBar = 0;
+  synchBeatTick = 0;
+  synchRealign = 0;
   synchState = SYNCH_STOP;
   synchSource = SYNCH_SOURCE_INTERNAL; 
 
@@ -111,6 +251,427 @@ void synchInit()
   synchChannels[3].setOutputPin(P_CLKOUT3);  
 }
 
+////////////////////////////////////////////////////////
+//
+// SONG MODE
+//
+// A pattern holds the packed settings of every channel. 
+// Patterns are stored in EEPROM, along with a chain of
+// up to 64 entries, each playing one pattern for 1-16 bars.
+// Only slots that have had a pattern stored in them can be
+// added to the chain.
+//
+// While a song plays, the next chain entry and its pattern
+// are read from EEPROM ahead of time by the main loop, so 
+// that at the bar boundary the tick engine only has to load
+// the channels from RAM
+//
+// Writing a byte of EEPROM takes 3.3ms, which the tick 
+// engine can't wait for. Edits are made to a copy in RAM,
+// and the main loop copies the changes to EEPROM a byte at
+// a time, whenever the EEPROM is ready for the next one
+//
+////////////////////////////////////////////////////////
+#define SONG_PATTERNS       16
+#define SONG_PATTERN_SIZE   (NUM_CHANNELS * PATTERN_CHAN_SIZE)
+#define SONG_CHAIN_MAX      64
+#define SONG_REPEAT_MAX     16
+
+// EEPROM layout
+#define SONG_EE_CHAIN_LEN   ((byte*)0x000)
+#define SONG_EE_EMPTY       ((byte*)0x001)
+#define SONG_EE_CHAIN       ((byte*)0x040)
+#define SONG_EE_PATTERNS    ((byte*)0x080)
+
+// Chain entries are a byte each
+#define SONG_ENTRY(pattern, repeats)  (((pattern)<<4)|((repeats)-1))
+#define SONG_ENTRY_PATTERN(e)         ((e)>>4)
+#define SONG_ENTRY_REPEATS(e)         (((e)&0x0F)+1)
+
+// A bit per pattern slot, set while the slot has never been
+// stored, so that blank EEPROM reads as all empty
+#define SONG_EMPTY(slot)    (songEmpty[(slot)>>3] & (1<<((slot)&7)))
+
+// What is waiting to be copied to EEPROM, in the order it is done
+enum {
+  SONG_FLUSH_PATTERN  = 0x01,
+  SONG_FLUSH_EMPTY    = 0x02,
+  SONG_FLUSH_CHAIN    = 0x04,
+  SONG_FLUSH_LENGTH   = 0x08
+};
+
+byte songPlaying;
+byte songPattern;                   // pattern slot selected in the menu
+byte songChainLength;
+byte songChain[SONG_CHAIN_MAX];     // copy of the chain in EEPROM
+byte songPosition;                  // chain entry now playing
+byte songBarsLeft;                  // bars left to play of this entry
+byte songStaged;                    // set when the next entry has been read
+byte songNextPosition;              
+byte songNextBars;                  
+byte songNext[SONG_PATTERN_SIZE];   // packed pattern for the next entry
+byte songStore[SONG_PATTERN_SIZE];  // packed pattern waiting to be written
+byte songStoreSlot;                 
+byte songEmpty[SONG_PATTERNS/8];    // copy of the empty slot bits in EEPROM
+byte songFlush;                     // SONG_FLUSH_xxx bits
+byte songFlushPos;                  // next byte to compare in the current copy
+
+void songInit()
+{
+  songPlaying = 0;
+  songPattern = 0;
+  songStaged = 0;
+  songFlush = 0;
+  songFlushPos = 0;
+  songChainLength = eeprom_read_byte(SONG_EE_CHAIN_LEN);
+  if(songChainLength > SONG_CHAIN_MAX) // blank EEPROM
+    songChainLength = 0;
+  eeprom_read_block(songChain, SONG_EE_CHAIN, songChainLength);
+  eeprom_read_block(songEmpty, SONG_EE_EMPTY, sizeof(songEmpty));
+}
+
+// Mark part of the song to be copied to EEPROM. The copy
+// starts again from the top, as bytes already passed may 
+// have changed
+void songFlushMark(byte what)
+{
+  songFlush |= what;
+  songFlushPos = 0;
+}
+
+// Copy changes to EEPROM (main loop). Bytes which already 
+// match are skipped, and at most one write is started
+void songWriteRun()
+{
+  while(songFlush && eeprom_is_ready())
+  {
+    byte *dest;
+    const byte *src;
+    byte len;
+    byte what;
+    if(songFlush & SONG_FLUSH_PATTERN)
+    {
+      what = SONG_FLUSH_PATTERN;
+      dest = SONG_EE_PATTERNS + songStoreSlot*SONG_PATTERN_SIZE;
+      src = songStore;
+      len = SONG_PATTERN_SIZE;
+    }
+    else if(songFlush & SONG_FLUSH_EMPTY)
+    {
+      // the slot is only marked once its pattern is written
+      what = SONG_FLUSH_EMPTY;
+      dest = SONG_EE_EMPTY;
+      src = songEmpty;
+      len = sizeof(songEmpty);
+    }
+    else if(songFlush & SONG_FLUSH_CHAIN)
+    {
+      // entries go in before the length that covers them
+      what = SONG_FLUSH_CHAIN;
+      dest = SONG_EE_CHAIN;
+      src = songChain;
+      len = songChainLength;
+    }
+    else
+    {
+      what = SONG_FLUSH_LENGTH;
+      dest = SONG_EE_CHAIN_LEN;
+      src = &songChainLength;
+      len = 1;
+    }
+    if(songFlushPos >= len)
+    {
+      songFlush &= ~what;
+      songFlushPos = 0;
+      continue;
+    }
+    byte value = src[songFlushPos];
+    if(eeprom_read_byte(dest + songFlushPos) != value)
+    {
+      eeprom_write_byte(dest + songFlushPos++, value);
+      break;
+    }
+    ++songFlushPos;
+  }
+}
+
+// Store the current settings of all channels as a pattern. 
+// Returns 0 if the last pattern stored is still being written
+byte songStorePattern(byte slot)
+{
+  if(songFlush & SONG_FLUSH_PATTERN)
+    return 0;
+  for(int i=0;i<NUM_CHANNELS;++i)
+    synchChannels[i].pack(songStore + i*PATTERN_CHAN_SIZE);
+  songStoreSlot = slot;
+  songEmpty[slot>>3] &= ~(1<<(slot&7));
+  songFlushMark(SONG_FLUSH_PATTERN|SONG_FLUSH_EMPTY);
+  return 1;
+}
+
+// Add a bar of a pattern to the end of the chain. Consecutive
+// bars of the same pattern share a chain entry. Slots with
+// nothing stored in them are left out
+void songAppend(byte slot)
+{
+  if(SONG_EMPTY(slot))
+    return;
+  if(songChainLength)
+  {
+    byte entry = songChain[songChainLength - 1];
+    if(SONG_ENTRY_PATTERN(entry) == slot && SONG_ENTRY_REPEATS(entry) < SONG_REPEAT_MAX)
+    {
+      songChain[songChainLength - 1] = SONG_ENTRY(slot, SONG_ENTRY_REPEATS(entry) + 1);
+      songFlushMark(SONG_FLUSH_CHAIN);
+      // the entry may already have been read for the next bar
+      if(songStaged && songNextPosition == songChainLength - 1)
+        songNextBars = SONG_ENTRY_REPEATS(entry) + 1;
+      return;
+    }
+  }
+  if(songChainLength < SONG_CHAIN_MAX)
+  {
+    songChain[songChainLength++] = SONG_ENTRY(slot, 1);
+    songFlushMark(SONG_FLUSH_CHAIN|SONG_FLUSH_LENGTH);
+  }
+}
+
+// Take the last bar off the end of the chain
+void songRemove()
+{
+  if(!songChainLength)
+    return;
+  byte entry = songChain[songChainLength - 1];
+  if(SONG_ENTRY_REPEATS(entry) > 1)
+  {
+    songChain[songChainLength - 1] = SONG_ENTRY(SONG_ENTRY_PATTERN(entry), SONG_ENTRY_REPEATS(entry) - 1);
+    songFlushMark(SONG_FLUSH_CHAIN);
+  }
+  else
+  {
+    --songChainLength;
+    songFlushMark(SONG_FLUSH_LENGTH);
+    if(songNextPosition >= songChainLength)
+      songNextPosition = 0;
+    // nothing left to play
+    if(!songChainLength)
+      songPlaying = 0;
+  }
+  songStaged = 0;
+}
+
+// Start the chain from the top at the next bar 
+void songPlay(byte play)
+{
+  songStaged = 0;
+  songBarsLeft = 0;
+  songNextPosition = 0;
+  songPlaying = play && songChainLength;
+}
+
+// Read the next chain entry and its pattern into RAM 
+// (called from the main loop, not the tick engine). This 
+// waits for any writes, so that the read does not have to
+void songPrefetch()
+{
+  if(!songPlaying || songStaged || songFlush || !eeprom_is_ready())
+    return;
+  byte entry = songChain[songNextPosition];
+  eeprom_read_block(songNext, SONG_EE_PATTERNS + SONG_ENTRY_PATTERN(entry)*SONG_PATTERN_SIZE, SONG_PATTERN_SIZE);
+  songNextBars = SONG_ENTRY_REPEATS(entry);
+  songStaged = 1;
+}
+
+// Called from the tick engine at the start of each bar
+void songBar()
+{
+  if(!songBarsLeft && songStaged)
+  {
+    for(int i=0;i<NUM_CHANNELS;++i)
+    {
+      synchChannels[i].unpack(songNext + i*PATTERN_CHAN_SIZE);
+      synchChannels[i].restart();
+    }
+    songPosition = songNextPosition;
+    songBarsLeft = songNextBars;
+    if(++songNextPosition >= songChainLength)
+      songNextPosition = 0;
+    songStaged = 0;
+  }
+  if(songBarsLeft)
+    --songBarsLeft;
+}
+
+////////////////////////////////////////////////////////
+//
+// LINK
+//
+// Keeps several units in step over the UART. The leader
+// runs from its internal clock and sends its position
+// every beat. A follower (synch source LINK) keeps running
+// its own tick engine but steers its tick period so that
+// its position matches the leader's, allowing for the link
+// latency measured by pinging the leader. 
+//
+// Followers all listen to the leader's TX line. Their TX 
+// lines can be joined with diodes to the leader's RX, as
+// pings are short and seldom
+//
+////////////////////////////////////////////////////////
+#define LINK_BAUD         31250
+#define LINK_BYTE_TIME    20972UL   // ms to send a byte (0.32ms at 16.16)
+#define LINK_PING_MS      500       // time between pings
+#define LINK_STAMP_MASK   0x3FFF
+#define LINK_SNAP_TICKS   6         // errors bigger than this are jumped rather than steered
+#define LINK_SLEW_BEATS   2         // errors are steered out over this many beats
+
+CSynchLink linkReceiver;
+byte linkLeader;
+unsigned long linkNextPing;
+unsigned int linkPingStamp;
+unsigned long linkRTT;              // round trip time (16.16 ms, 0 until measured)
+
+void linkInit()
+{
+  Serial.begin(LINK_BAUD);
+  linkLeader = 0;
+  linkNextPing = 0;
+  linkRTT = 0;
+}
+
+// Follow the link or go back to the internal clock, carrying
+// on at the tempo we were following
+void synchSetSource(byte source)
+{
+  if(source == synchSource)
+    return;
+  synchSource = source;
+  if(SYNCH_SOURCE_LINK == source)
+  {
+    synchRampTicksLeft = 0;
+    linkLeader = 0;
+    linkRTT = 0;
+  }
+  else
+  {
+    synchSetBPM((double)SYNCH_PERIOD_BPM/synchTickPeriod);
+  }
+}
+
+void linkSetLeader(byte leader)
+{
+  linkLeader = leader;
+  // put the channels in step with the bar count that is sent
+  if(leader) 
+    synchRealign = 1;
+}
+
+// Send our position at the start of each beat (tick engine)
+void linkTick()
+{
+  if(linkLeader && synchSource == SYNCH_SOURCE_INTERNAL && !synchBeatTick)
+  {
+    byte buf[LINK_POSITION_LEN];
+    Serial.write(buf, CSynchLink::encodePosition(buf, synchBar, synchBarTick, synchTickPeriod));
+  }
+}
+
+// A position has arrived from the leader.. compare it with 
+// our own position, both in 16.16 ticks, and steer towards it
+void linkFollow(unsigned long milliseconds)
+{
+  unsigned long period = linkReceiver.period;
+  if(!period || linkReceiver.position >= TICKS_PER_BAR)
+    return;
+
+  // where the leader is now, allowing for the time the frame
+  // took to get here. Half the ping round trip covers a ping 
+  // sized frame, a position frame takes a few bytes longer
+  unsigned long latency = linkRTT/2 + (LINK_POSITION_LEN - LINK_PING_LEN) * LINK_BYTE_TIME;
+  long leaderPos = ((long)linkReceiver.position << 16) + ((unsigned long long)latency << 16) / period;
+
+  // where we are now, going back from the next tick
+  unsigned long pending = 0;
+  if(synchNextTick >= milliseconds)
+    pending = ((synchNextTick - milliseconds) << 16) + synchNextTickFrac;
+  long ownPos = ((long)synchBarTick << 16) - ((unsigned long long)pending << 16) / synchTickPeriod;
+
+  // the bar counts must agree too, as the channels' places in 
+  // their loops are worked out from them
+  long barLength = (long)TICKS_PER_BAR << 16;
+  long barDiff = (linkReceiver.bar - synchBar) & LINK_BAR_MASK;
+  if(barDiff > (long)(LINK_BAR_MASK/2))
+    barDiff -= LINK_BAR_MASK + 1;
+  long error = 0;
+  if(labs(barDiff) <= 1)
+    error = barDiff * barLength + leaderPos - ownPos;
+
+  if(labs(barDiff) > 1 || labs(error) > ((long)LINK_SNAP_TICKS << 16))
+  {
+    // too far out.. jump straight to the leader's position and 
+    // put the channels back in step at the next bar
+    unsigned long bar = linkReceiver.bar;
+    while(leaderPos >= barLength)
+    {
+      leaderPos -= barLength;
+      ++bar;
+    }
+    synchBarTick = (leaderPos >> 16) + 1;
+    pending = ((unsigned long long)(((long)synchBarTick << 16) - leaderPos) * period) >> 16;
+    if(synchBarTick >= TICKS_PER_BAR)
+    {
+      synchBarTick = 0;
+      ++bar;
+    }
+    synchBar = bar & LINK_BAR_MASK;
+    synchBeatTick = synchBarTick % TICKS_PER_BEAT;
+    synchNextTick = milliseconds + (pending >> 16);
+    synchNextTickFrac = pending & 0xFFFF;
+    synchTickPeriod = period;
+    synchUpdateChannels();
+    synchRealign = 1;
+  }
+  else
+  {
+    // run a little faster or slower than the leader so as to 
+    // catch up over the next few beats
+    long correction = ((long long)period * error) / ((long)LINK_SLEW_BEATS * TICKS_PER_BEAT << 16);
+    synchSetPeriod(period - correction);
+  }
+}
+
+// Handle link traffic (main loop)
+void linkRun(unsigned long milliseconds)
+{
+  byte buf[LINK_FRAME_MAX];
+  while(Serial.available())
+  {
+    switch(linkReceiver.receive(Serial.read()))
+    {
+    case LINK_PING:
+      Serial.write(buf, CSynchLink::encodeStamp(buf, LINK_PONG, linkReceiver.stamp));
+      break;
+    case LINK_PONG:
+      if(synchSource == SYNCH_SOURCE_LINK && linkReceiver.stamp == linkPingStamp)
+      {
+        unsigned long rtt = (unsigned long)((milliseconds - linkReceiver.stamp) & LINK_STAMP_MASK) << 16;
+        linkRTT = linkRTT? (3*linkRTT + rtt)/4 : rtt;
+      }
+      break;
+    case LINK_POSITION:
+      if(synchSource == SYNCH_SOURCE_LINK)
+        linkFollow(milliseconds);
+      break;
+    }
+  }
+  if(synchSource == SYNCH_SOURCE_LINK && milliseconds >= linkNextPing)
+  {
+    linkNextPing = milliseconds + LINK_PING_MS;
+    linkPingStamp = milliseconds & LINK_STAMP_MASK;
+    Serial.write(buf, CSynchLink::encodeStamp(buf, LINK_PING, linkPingStamp));
+  }
+}
+
 // Run the ticker outputs
 void synchRun(unsigned long milliseconds)
 {
@@ -122,15 +683,41 @@ void synchRun(unsigned long milliseconds)
     for(i=0;i<NUM_CHANNELS;++i)
       synchChannels[i].timerRollover();
     synchNextTick = 0;
+    synchNextTickFrac = 0;
   }
   synchLastMilliseconds = milliseconds;
 
   // Time for the next tick?
   if(synchNextTick < milliseconds)
   {
-    synchNextTick += synchMillisPerTick;
+    if(synchRampTicksLeft)
+      synchRampTick();
+    unsigned long frac = (unsigned long)synchNextTickFrac + (synchTickPeriod & 0xFFFF);
+    synchNextTick += (synchTickPeriod >> 16) + (frac >> 16);
+    synchNextTickFrac = frac & 0xFFFF;
     if(synchNextTick < milliseconds)
-      synchNextTick = milliseconds + synchMillisPerTick;     
+    {
+      synchNextTick = milliseconds + (synchTickPeriod >> 16);     
+      synchNextTickFrac = synchTickPeriod & 0xFFFF;
+    }
+    if(synchRealign && synchBarTick == TICKS_PER_BAR - 1)
+    {
+      // a tick ahead of the bar, so that the main loop has time
+      // to catch the channels' plans up before it starts
+      for(i=0;i<NUM_CHANNELS;++i)
+        synchChannels[i].restart(synchBar * TICKS_PER_BAR + synchBarTick);
+      synchRealign = 0;
+    }
+    if(!synchBarTick && songPlaying)
+      songBar();
+    linkTick();
+    if(++synchBarTick >= TICKS_PER_BAR)
+    {
+      synchBarTick = 0;
+      synchBar = (synchBar + 1) & LINK_BAR_MASK;
+    }
+    if(++synchBeatTick >= TICKS_PER_BEAT)
+      synchBeatTick = 0;
     for(i=0;i<NUM_CHANNELS;++i)
     {
       synchChannels[i].tick();
@@ -179,6 +766,7 @@ enum {
   MENU_CHAN_PARAM4,
   MENU_CHAN_STEPS,
   MENU_CHAN_DIV,
+  MENU_CHAN_GATEMODE,
   MENU_CHAN_PULSEMS,
   MENU_CHAN_RECOVERMS,
   MENU_CHAN_INVERT,  
@@ -188,7 +776,21 @@ enum {
 enum {
   MENU_GLOBAL_RUN = 0,
   MENU_GLOBAL_BPM,
+  MENU_GLOBAL_RAMP_BPM,
+  MENU_GLOBAL_RAMP_BEATS,
+  MENU_GLOBAL_RAMP_SHAPE,
+  MENU_GLOBAL_PATTERN,
+  MENU_GLOBAL_CHAIN,
+  MENU_GLOBAL_SONG,
+  MENU_GLOBAL_LINK,
   MENU_GLOBAL_SYNCH,
+#if HEALTH_MONITOR
+  MENU_GLOBAL_FREERAM,
+  MENU_GLOBAL_STACK,
+  MENU_GLOBAL_ISRTIME,
+  MENU_GLOBAL_RUNTIME,
+  MENU_GLOBAL_OVERRUNS,
+#endif
   MENU_GLOBAL_MAX  
 };
 
@@ -235,6 +837,45 @@ void menuDisplayGlobalParam()
     TUI.show(DGT_T|SEG_DP);
     TUI.showNumber(synchBPM,1);
     break;
+  case MENU_GLOBAL_RAMP_BPM:
+    TUI.show(DGT_R|SEG_DP);
+    TUI.showNumber(synchBPM,1);
+    break;
+  case MENU_GLOBAL_RAMP_BEATS:
+    TUI.show(DGT_B|SEG_DP);
+    TUI.showNumber(synchRampBeats,1);
+    break;
+  case MENU_GLOBAL_RAMP_SHAPE:
+    switch(synchRampShape)
+    {
+    case SYNCH_RAMP_LINEAR:
+      TUI.show(DGT_C|SEG_DP, DGT_L, DGT_I, DGT_N);
+      break;
+    case SYNCH_RAMP_EXPONENTIAL:
+      TUI.show(DGT_C|SEG_DP, DGT_E, DGT_X, DGT_P);
+      break;
+    }
+    break;
+  case MENU_GLOBAL_PATTERN:
+    TUI.show(DGT_P|SEG_DP);
+    TUI.showNumber(songPattern+1,1);
+    break;
+  case MENU_GLOBAL_CHAIN:
+    TUI.show(DGT_C|SEG_DP);
+    TUI.showNumber(songChainLength,1);
+    break;
+  case MENU_GLOBAL_SONG:
+    if(songPlaying)
+      TUI.show(DGT_S, DGT_O|SEG_DP, DGT_O, DGT_N);
+    else
+      TUI.show(DGT_S, DGT_O|SEG_DP, DGT_O, DGT_F);
+    break;
+  case MENU_GLOBAL_LINK:
+    if(linkLeader)
+      TUI.show(DGT_L|SEG_DP, DGT_O, DGT_N);
+    else
+      TUI.show(DGT_L|SEG_DP, DGT_O, DGT_F, DGT_F);
+    break;
   case MENU_GLOBAL_SYNCH:
     switch(synchSource)
     {
@@ -247,8 +888,33 @@ void menuDisplayGlobalParam()
     case SYNCH_SOURCE_CV:
       TUI.show(DGT_S|SEG_DP, DGT_E, DGT_X, DGT_T);
       break;
+    case SYNCH_SOURCE_LINK:
+      TUI.show(DGT_S|SEG_DP, DGT_L, DGT_N, DGT_K);
+      break;
     }
     break;
+#if HEALTH_MONITOR
+  case MENU_GLOBAL_FREERAM:
+    TUI.show(DGT_F|SEG_DP);
+    TUI.showNumber(min(CHealth::freeRAM(),999),1);
+    break;
+  case MENU_GLOBAL_STACK:
+    TUI.show(DGT_H|SEG_DP);
+    TUI.showNumber(min(CHealth::stackHeadroom(),999),1);
+    break;
+  case MENU_GLOBAL_ISRTIME:
+    TUI.show(DGT_I|SEG_DP);
+    TUI.showNumber(min(CHealth::isrMaxMicros(),999),1);
+    break;
+  case MENU_GLOBAL_RUNTIME:
+    TUI.show(DGT_U|SEG_DP);
+    TUI.showNumber(min(CHealth::runMaxMicros(),999),1);
+    break;
+  case MENU_GLOBAL_OVERRUNS:
+    TUI.show(DGT_O|SEG_DP);
+    TUI.showNumber(min(healthOverruns,999),1);
+    break;
+#endif
   }
 }
 
@@ -288,6 +954,14 @@ void menuDisplayChannelParam()
     TUI.show(DGT_D, DGT_I|SEG_DP);
     TUI.showNumber(synchChannels[menuContext].getParam(CSynchChannel::PARAM_DIV), 2);
     break;                   
+  case MENU_CHAN_GATEMODE:
+    switch(synchChannels[menuContext].getParam(CSynchChannel::PARAM_GATEMODE))
+    {
+    case CSynchChannel::GATE_STEP:  TUI.show(DGT_G|SEG_DP, DGT_S, DGT_T); break;
+    case CSynchChannel::GATE_TICKS: TUI.show(DGT_G|SEG_DP, DGT_T, DGT_C); break;
+    default:                        TUI.show(DGT_G|SEG_DP, DGT_M, DGT_S); break;
+    }
+    break;                   
   case MENU_CHAN_PULSEMS:
     TUI.show(DGT_P, DGT_T|SEG_DP);
     TUI.showNumber(synchChannels[menuContext].getParam(CSynchChannel::PARAM_PULSEMS), 2);
@@ -349,8 +1023,18 @@ void menuSelectParam(byte next)
         else
           --menuParam;
       }
-      if(menuParam != MENU_GLOBAL_BPM || synchSource == SYNCH_SOURCE_INTERNAL) // skip BPM option when not using internal synch
+      if(synchSource == SYNCH_SOURCE_INTERNAL) 
         break;
+      switch(menuParam) // skip tempo options when not using internal synch
+      {
+      case MENU_GLOBAL_BPM:
+      case MENU_GLOBAL_RAMP_BPM:
+      case MENU_GLOBAL_RAMP_BEATS:
+      case MENU_GLOBAL_RAMP_SHAPE:
+      case MENU_GLOBAL_LINK:
+        continue;
+      }
+      break;
     }
     break;
 
@@ -431,11 +1115,49 @@ void menuChangeParam(byte inc)
         break;
       }
     case MENU_GLOBAL_BPM:
-      if(inc && synchBPM < 350) synchSetBPM(synchBPM+1);
-      else if(!inc && synchBPM > 1) synchSetBPM(synchBPM-1);
+      // a tapped tempo can be fractional, so keep the result in range
+      if(inc && synchBPM < 350) synchSetBPM(constrain(synchBPM+1, 1, 350));
+      else if(!inc && synchBPM > 1) synchSetBPM(constrain(synchBPM-1, 1, 350));
+      break;
+    case MENU_GLOBAL_RAMP_BPM:
+      if(inc && synchBPM < 350) synchRampBPM(constrain(synchBPM+1, 1, 350));
+      else if(!inc && synchBPM > 1) synchRampBPM(constrain(synchBPM-1, 1, 350));
+      break;
+    case MENU_GLOBAL_RAMP_BEATS:
+      if(inc && synchRampBeats < 99) ++synchRampBeats;
+      else if(!inc && synchRampBeats > 1) --synchRampBeats;
+      break;
+    case MENU_GLOBAL_RAMP_SHAPE:
+      synchRampShape = inc? SYNCH_RAMP_EXPONENTIAL : SYNCH_RAMP_LINEAR;
+      break;
+    case MENU_GLOBAL_PATTERN:
+      if(inc && songPattern < SONG_PATTERNS-1) ++songPattern;
+      else if(!inc && songPattern > 0) --songPattern;
+      break;
+    case MENU_GLOBAL_CHAIN:
+      if(inc) songAppend(songPattern);
+      else songRemove();
+      break;
+    case MENU_GLOBAL_SONG:
+      songPlay(inc);
+      break;
+    case MENU_GLOBAL_LINK:
+      linkSetLeader(inc);
       break;
     case MENU_GLOBAL_SYNCH:
+      synchSetSource(inc? SYNCH_SOURCE_LINK : SYNCH_SOURCE_INTERNAL);
+      break;
+#if HEALTH_MONITOR
+    case MENU_GLOBAL_FREERAM:
+    case MENU_GLOBAL_STACK:
+    case MENU_GLOBAL_ISRTIME:
+    case MENU_GLOBAL_RUNTIME:
+    case MENU_GLOBAL_OVERRUNS:
+      // INC just refreshes the figures, DEC clears the worst cases
+      if(!inc) 
+        CHealth::reset();
       break;
+#endif
     }
     break;
   case MENU_CONTEXT_CHAN1:
@@ -465,6 +1187,9 @@ void menuChangeParam(byte inc)
     case MENU_CHAN_DIV:      
       synchChannels[menuContext].changeParam(CSynchChannel::PARAM_DIV, inc); 
       break;
+    case MENU_CHAN_GATEMODE: 
+      synchChannels[menuContext].changeParam(CSynchChannel::PARAM_GATEMODE, inc); 
+      break;
     case MENU_CHAN_PULSEMS:  
       synchChannels[menuContext].changeParam(CSynchChannel::PARAM_PULSEMS, inc); 
       break;
@@ -480,6 +1205,27 @@ void menuChangeParam(byte inc)
   menuDisplayParam();        
 };
 
+///////////////////////////////////////////////////////////////
+// Hold ENTER on the pattern page to store the channels there
+void menuHold()
+{
+  if(menuContext == MENU_CONTEXT_GLOBAL && menuParam == MENU_GLOBAL_PATTERN)
+  {
+    if(songStorePattern(songPattern))
+      TUI.show(DGT_S, DGT_T, DGT_O, DGT_R);
+    else
+      TUI.show(DGT_B, DGT_U, DGT_S, DGT_Y);
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Tap tempo key.. show the BPM once it has been set
+void menuTap()
+{
+  if(synchTap(millis()) && menuContext == MENU_CONTEXT_GLOBAL && menuParam == MENU_GLOBAL_BPM)
+    menuDisplayParam();
+}
+
 ///////////////////////////////////////////////////////////////
 // Select a different meny
 void menuSetContext(byte context)
@@ -553,6 +1299,14 @@ void menuKeyPressHandler(unsigned int keyStatus)
   case TUI_AUTO|MENU_KEY_INC:
     menuChangeParam(1);
     break;
+
+  case TUI_PRESS|MENU_KEY_ENTER:  // tap tempo
+  case TUI_DOUBLE|MENU_KEY_ENTER:
+    menuTap();
+    break;
+  case TUI_HOLD|MENU_KEY_ENTER:
+    menuHold();
+    break;
   }
 }
 
@@ -609,7 +1363,12 @@ void setup()
   digitalWrite(P_CLKOUT3,HIGH);      
 
   cli();
+#if HEALTH_MONITOR
+  CHealth::init();
+#endif
   synchInit();  
+  songInit();
+  linkInit();
   heartBeatInit();
   TUI.init();     
   TUI.setExtraKey(TUI_KEY_A, P_SELECT);
@@ -623,11 +1382,18 @@ void setup()
 unsigned long prevMilliseconds = 0;
 void loop()
 {
+  HEALTH_PASS();
   unsigned long milliseconds = millis();
   if(prevMilliseconds != milliseconds)
   {
     prevMilliseconds = milliseconds;
+    HEALTH_TIMER_START();
     synchRun(milliseconds);
+    HEALTH_TIMER_END(healthRunMax);
+    linkRun(milliseconds);
+    synchPlan();
+    songWriteRun();
+    songPrefetch();
     heartBeatRun(milliseconds);
     TUI.run(milliseconds);
   }
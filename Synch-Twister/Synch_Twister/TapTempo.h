@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////
+//
+// TAP TEMPO
+//
+// Keeps a ring buffer of the most recent tap times and
+// estimates the tempo from the median tap interval,
+// averaging only those intervals close to the median
+// so that a single fumbled tap does not pull the tempo
+//
+////////////////////////////////////////////////////////
+
+#define TAP_BUFFER_SIZE   8     // number of tap times remembered
+#define TAP_MIN_TAPS      3     // taps needed before a tempo is reported
+#define TAP_TIMEOUT_MS    2500  // a longer gap than this starts a new sequence
+#define TAP_TOLERANCE     8     // inliers are within 1/TAP_TOLERANCE of the median
+
+class CTapTempo
+{
+  unsigned long tapTime[TAP_BUFFER_SIZE];  // ring buffer of tap times
+  byte tapIndex;                           // where the next tap time is stored
+  byte tapCount;                           // number of valid entries
+
+public:
+  ////////////////////////////////////////////////////////
+  CTapTempo()
+  {
+    reset();
+  }
+
+  ////////////////////////////////////////////////////////
+  void reset()
+  {
+    tapIndex = 0;
+    tapCount = 0;
+  }
+
+  ////////////////////////////////////////////////////////
+  // Register a tap. Returns nonzero and sets bpm once enough
+  // consistent taps have been seen
+  byte tap(unsigned long milliseconds, double *bpm)
+  {
+    if(tapCount)
+    {
+      unsigned long lastTap = tapTime[(tapIndex + TAP_BUFFER_SIZE - 1) % TAP_BUFFER_SIZE];
+      if(milliseconds < lastTap || milliseconds - lastTap > TAP_TIMEOUT_MS)
+        tapCount = 0;
+    }
+    tapTime[tapIndex] = milliseconds;
+    tapIndex = (tapIndex + 1) % TAP_BUFFER_SIZE;
+    if(tapCount < TAP_BUFFER_SIZE)
+      ++tapCount;
+    if(tapCount < TAP_MIN_TAPS)
+      return 0;
+
+    // collect the intervals between taps, newest first, in
+    // ascending order (insertion sort - there are only a few)
+    unsigned int interval[TAP_BUFFER_SIZE - 1];
+    byte numIntervals = tapCount - 1;
+    byte i, j;
+    for(i = 0; i < numIntervals; ++i)
+    {
+      byte newer = (tapIndex + TAP_BUFFER_SIZE - 1 - i) % TAP_BUFFER_SIZE;
+      byte older = (tapIndex + TAP_BUFFER_SIZE - 2 - i) % TAP_BUFFER_SIZE;
+      unsigned int t = tapTime[newer] - tapTime[older];
+      for(j = i; j > 0 && interval[j-1] > t; --j)
+        interval[j] = interval[j-1];
+      interval[j] = t;
+    }
+
+    // the median interval
+    unsigned int median = interval[numIntervals/2];
+    if(!(numIntervals % 2))
+      median = (median + interval[numIntervals/2 - 1])/2;
+    if(!median)
+      return 0;
+
+    // average the intervals which are close to the median
+    unsigned int tolerance = median / TAP_TOLERANCE;
+    unsigned long total = 0;
+    byte inliers = 0;
+    for(i = 0; i < numIntervals; ++i)
+    {
+      if(interval[i] + tolerance >= median && interval[i] <= median + tolerance)
+      {
+        total += interval[i];
+        ++inliers;
+      }
+    }
+    if(inliers < TAP_MIN_TAPS - 1)
+      return 0;
+    *bpm = (60000.0 * inliers) / total;
+    return 1;
+  }
+};
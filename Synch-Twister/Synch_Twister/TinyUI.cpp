@@ -1,6 +1,7 @@
 ////////////////////////////////////////////////////////
 #include "Arduino.h"
 #include "TinyUI.h"
+#include "Health.h"
 
 #define P_DIGIT0  16
 #define P_DIGIT1  15
@@ -248,6 +249,8 @@ void CTinyUI::show(byte seg0, byte seg1, byte seg2, byte seg3)
 // Interrupt service routing that refreshes the LEDs
 ISR(TIMER2_OVF_vect) 
 {
+  HEALTH_TIMER_START();
+
   // Read the switch status (do it now, rather than on previous
   // tick so we can ensure adequate setting time)
   if(PINB & BBIT_SWREAD)
@@ -328,6 +331,8 @@ ISR(TIMER2_OVF_vect)
   // Next pass we'll check the next display
   if(++uiLEDIndex >= UI_MAXLEDARRAY)
     uiLEDIndex = 0;
+
+  HEALTH_TIMER_END(healthISRMax);
 }
 
 ////////////////////////////////////////////////////////
@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////
+//
+// Host stand-in for the parts of the Arduino core used
+// by the sketch, shared by the host tools so that it can
+// be built, checked and rendered on a PC. The definitions
+// are in HostArduino.cpp
+//
+// Time only moves when a tool moves it, by setting
+// hostMicros. The AVR registers are plain variables
+// which nothing reads back. Each thread has its own
+// random number state and its own pin handler
+//
+////////////////////////////////////////////////////////
+#ifndef ARDUINO_HOST_H
+#define ARDUINO_HOST_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <type_traits>
+
+typedef uint8_t byte;
+
+#define HIGH   1
+#define LOW    0
+#define INPUT  0
+#define OUTPUT 1
+
+// functions rather than the core's macros, so that the
+// standard library headers can be included in any order
+template<class A, class B> inline typename std::common_type<A, B>::type min(A a, B b)
+{
+  typename std::common_type<A, B>::type x = a, y = b;
+  return (x < y)? x : y;
+}
+template<class A, class B> inline typename std::common_type<A, B>::type max(A a, B b)
+{
+  typename std::common_type<A, B>::type x = a, y = b;
+  return (x > y)? x : y;
+}
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+#define ISR(vector) void vector(void)
+inline void cli() {}
+inline void sei() {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// registers touched by the sketch
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR2A, TCCR2B, TIMSK2, TCNT2;
+extern volatile uint8_t PINB, PORTC, PORTD;
+extern volatile uint16_t TCNT1, SP;
+enum { CS11 = 1, CS20 = 0, CS21 = 1, CS22 = 2, TOIE2 = 0 };
+
+// the virtual clock
+extern unsigned long hostMicros;
+inline unsigned long micros() { return hostMicros; }
+inline unsigned long millis() { return hostMicros / 1000; }
+
+// output pins.. the handler, if any, sees every write
+// made on the thread that set it
+typedef void (*HostPinFunc)(void *context, byte pin, byte value);
+void hostSetPinHandler(HostPinFunc f, void *context);
+inline void pinMode(byte pin, byte mode) {}
+inline int digitalRead(byte pin) { return HIGH; }
+void digitalWrite(byte pin, byte value);
+
+// Same sequence as random() and randomSeed() on the AVR
+long random(long howbig);
+void randomSeed(unsigned long seed);
+
+////////////////////////////////////////////////////////
+// The UART, carried over a file descriptor (a pty, say).
+// Received bytes are handed over no faster than the baud
+// rate allows, timed by the virtual clock. With no file
+// descriptor it sends nothing and receives nothing
+class HardwareSerial
+{
+  int fd;
+  unsigned long byteMicros;   // time to send a byte
+  unsigned long nextMicros;   // when the next byte can be handed over
+  int pending;                // byte read from fd but not yet handed over
+public:
+  HardwareSerial();
+  void setFD(int f);
+  void begin(unsigned long baud);
+  int available();
+  int read();
+  size_t write(byte b);
+  size_t write(const byte *buf, size_t len);
+};
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,202 @@
+////////////////////////////////////////////////////////
+//
+// HOST ARDUINO FUNCTIONS
+//
+// Definitions for the stand-ins in Arduino.h and
+// avr/eeprom.h
+//
+////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include <avr/eeprom.h>
+
+volatile uint8_t TCCR1A, TCCR1B, TCCR2A, TCCR2B, TIMSK2, TCNT2;
+volatile uint8_t PINB, PORTC, PORTD;
+volatile uint16_t TCNT1, SP;
+
+// ends of the heap, used by the health monitor
+unsigned char __heap_start;
+char *__brkval;
+
+unsigned long hostMicros;
+HardwareSerial Serial;
+
+static thread_local unsigned long hostRandomContext = 1;
+static thread_local HostPinFunc hostPinHandler;
+static thread_local void *hostPinContext;
+
+////////////////////////////////////////////////////////
+void hostSetPinHandler(HostPinFunc f, void *context)
+{
+  hostPinHandler = f;
+  hostPinContext = context;
+}
+
+////////////////////////////////////////////////////////
+void digitalWrite(byte pin, byte value)
+{
+  if(hostPinHandler)
+    hostPinHandler(hostPinContext, pin, value);
+}
+
+////////////////////////////////////////////////////////
+// Park-Miller generator, as used by avr-libc random()
+long random(long howbig)
+{
+  if(!howbig)
+    return 0;
+  long x = hostRandomContext;
+  if(!x)
+    x = 123459876L;
+  long hi = x / 127773L;
+  long lo = x % 127773L;
+  x = 16807L * lo - 2836L * hi;
+  if(x < 0)
+    x += 0x7fffffffL;
+  hostRandomContext = x;
+  return (x % 0x80000000UL) % howbig;
+}
+
+////////////////////////////////////////////////////////
+void randomSeed(unsigned long seed)
+{
+  if(seed)
+    hostRandomContext = seed;
+}
+
+////////////////////////////////////////////////////////
+//
+// SERIAL
+//
+////////////////////////////////////////////////////////
+HardwareSerial::HardwareSerial()
+{
+  fd = -1;
+  byteMicros = 0;
+  nextMicros = 0;
+  pending = -1;
+}
+
+////////////////////////////////////////////////////////
+void HardwareSerial::setFD(int f)
+{
+  fd = f;
+}
+
+////////////////////////////////////////////////////////
+void HardwareSerial::begin(unsigned long baud)
+{
+  // start bit, 8 data bits, stop bit
+  byteMicros = 10000000UL / baud;
+}
+
+////////////////////////////////////////////////////////
+int HardwareSerial::available()
+{
+  if(pending < 0 && fd >= 0)
+  {
+    byte b;
+    if(::read(fd, &b, 1) == 1)
+    {
+      // the byte takes a byte time to arrive, after the one before
+      pending = b;
+      nextMicros = max(nextMicros, hostMicros) + byteMicros;
+    }
+  }
+  return (pending >= 0 && hostMicros >= nextMicros)? 1 : 0;
+}
+
+////////////////////////////////////////////////////////
+int HardwareSerial::read()
+{
+  if(!available())
+    return -1;
+  int b = pending;
+  pending = -1;
+  return b;
+}
+
+////////////////////////////////////////////////////////
+size_t HardwareSerial::write(byte b)
+{
+  return write(&b, 1);
+}
+
+////////////////////////////////////////////////////////
+size_t HardwareSerial::write(const byte *buf, size_t len)
+{
+  if(fd < 0)
+    return len;
+  ssize_t n = ::write(fd, buf, len);
+  return (n < 0)? 0 : n;
+}
+
+////////////////////////////////////////////////////////
+//
+// EEPROM
+//
+////////////////////////////////////////////////////////
+uint8_t hostEEPROM[E2END + 1];
+unsigned long hostEEPROMStalls;
+static unsigned long eepromReadyMicros;
+
+// starts out blank
+static struct EEPROMBlank
+{
+  EEPROMBlank() { memset(hostEEPROM, 0xFF, sizeof(hostEEPROM)); }
+} eepromBlank;
+
+////////////////////////////////////////////////////////
+// Wait for a write in progress to finish
+static void eepromWait()
+{
+  if(hostMicros < eepromReadyMicros)
+  {
+    ++hostEEPROMStalls;
+    hostMicros = eepromReadyMicros;
+  }
+}
+
+////////////////////////////////////////////////////////
+int eeprom_is_ready()
+{
+  return hostMicros >= eepromReadyMicros;
+}
+
+////////////////////////////////////////////////////////
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+  eepromWait();
+  return hostEEPROM[(uintptr_t)p & E2END];
+}
+
+////////////////////////////////////////////////////////
+void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+  eepromWait();
+  hostEEPROM[(uintptr_t)p & E2END] = value;
+  eepromReadyMicros = hostMicros + HOST_EEPROM_WRITE_US;
+}
+
+////////////////////////////////////////////////////////
+void eeprom_update_byte(uint8_t *p, uint8_t value)
+{
+  if(eeprom_read_byte(p) != value)
+    eeprom_write_byte(p, value);
+}
+
+////////////////////////////////////////////////////////
+void eeprom_read_block(void *dest, const void *src, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    ((uint8_t*)dest)[i] = eeprom_read_byte((const uint8_t*)src + i);
+}
+
+////////////////////////////////////////////////////////
+void eeprom_update_block(const void *src, void *dest, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    eeprom_update_byte((uint8_t*)dest + i, ((const uint8_t*)src)[i]);
+}
@@ -0,0 +1,29 @@
+////////////////////////////////////////////////////////
+//
+// Host stand-in for avr-libc's EEPROM functions. Like the
+// real thing, writing a byte takes 3.3ms, and any access
+// while a write is in progress waits for it to finish.
+// Here the wait moves the virtual clock on, and is counted
+// in hostEEPROMStalls
+//
+////////////////////////////////////////////////////////
+#ifndef AVR_EEPROM_HOST_H
+#define AVR_EEPROM_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define E2END               0x3FF
+#define HOST_EEPROM_WRITE_US 3300
+
+extern uint8_t hostEEPROM[E2END + 1];
+extern unsigned long hostEEPROMStalls;
+
+int eeprom_is_ready();
+uint8_t eeprom_read_byte(const uint8_t *p);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+void eeprom_update_byte(uint8_t *p, uint8_t value);
+void eeprom_read_block(void *dest, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dest, size_t n);
+
+#endif
@@ -0,0 +1,498 @@
+////////////////////////////////////////////////////////
+//
+// T W I S T E R   R E N D E R
+//
+// Renders the pulse trains of the real channel and
+// mutator code offline, for a sweep of settings
+// (mutator x parameters x steps x BPM), to VCD or CSV
+// timing files, and writes a summary of each setting
+// including a histogram of how far each step landed
+// from the straight grid.
+//
+// Settings are handed out to worker threads from a
+// shared queue, one thread per core by default.
+//
+// Build from this folder with
+//
+//   g++ -O2 -std=c++11 -pthread -I../HostArduino -I../../Synch_Twister -o twister-render
+//     TwisterRender.cpp ../HostArduino/HostArduino.cpp
+//
+// (all on one line)
+//
+////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Arduino.h"
+#include "TinyUI.h"
+#include "Synch_Twister.h"
+#include "Mutators.h"
+#include "SynchChannel.h"
+
+////////////////////////////////////////////////////////
+//
+// RENDERING
+//
+////////////////////////////////////////////////////////
+
+#define RENDER_HIST_WIDTH  4    // ticks per histogram bin
+#define RENDER_HIST_BINS   ((2 * TICKS_PER_STEP) / RENDER_HIST_WIDTH + 1)
+
+// option letter for each mutator parameter, also used in file names
+#define RENDER_PARAM_FLAGS "pqrt"
+static_assert(sizeof(RENDER_PARAM_FLAGS) - 1 == MUTATOR_PARAMS_MAX, "one option per mutator parameter");
+
+enum {
+  FORMAT_NONE,
+  FORMAT_VCD,
+  FORMAT_CSV
+};
+
+// One setting of the sweep
+struct JOB
+{
+  byte mutator;
+  int param[MUTATOR_PARAMS_MAX];
+  int steps;
+  int bpm;
+};
+
+struct PULSE
+{
+  unsigned long start;     // ms
+  unsigned long end;       // ms
+  long tick;               // tick on which the pulse started
+  int step;                // step within the loop
+  int offset;              // ticks away from the straight grid
+};
+
+// Results of rendering one setting
+struct RESULT
+{
+  unsigned long pulses;
+  unsigned long missed;
+  long minOffset;
+  long maxOffset;
+  double meanOffset;
+  unsigned long hist[RENDER_HIST_BINS];
+  byte failed;
+};
+
+struct RENDER
+{
+  std::vector<PULSE> pulses;
+  unsigned long milliseconds;
+  long tick;
+};
+
+////////////////////////////////////////////////////////
+static void renderPin(void *context, byte pin, byte value)
+{
+  RENDER *r = (RENDER*)context;
+  if(value)
+  {
+    PULSE p;
+    p.start = r->milliseconds;
+    p.end = r->milliseconds;
+    p.tick = r->tick;
+    p.step = 0;
+    p.offset = 0;
+    r->pulses.push_back(p);
+  }
+  else if(!r->pulses.empty())
+  {
+    r->pulses.back().end = r->milliseconds;
+  }
+}
+
+////////////////////////////////////////////////////////
+// Run one channel for a number of bars. The timing mirrors
+// synchRun() in the sketch, one pass per millisecond
+static void renderChannel(CSynchChannel &channel, const JOB &job, int bars, RENDER &r)
+{
+  // every setting starts from the same random sequence
+  randomSeed(1);
+  channel.setParam(CSynchChannel::PARAM_MUTATION, job.mutator);
+  channel.setParam(CSynchChannel::PARAM_STEPS, job.steps);
+  CMutator *m = channel.getMutator();
+  for(int i = 0; i < MUTATOR_PARAMS_MAX && i < m->getNumParams(); ++i)
+    m->setParam(i, job.param[i]);
+  // the first loop is planned from these settings
+  channel.reset();
+
+  hostSetPinHandler(renderPin, &r);
+  unsigned long period = SYNCH_PERIOD_BPM/(double)job.bpm + 0.5;
+  channel.setTickPeriod(period);
+  unsigned long nextTick = 0;
+  unsigned long nextTickFrac = 0;
+  long totalTicks = (long)bars * TICKS_PER_BAR;
+  r.tick = -1;
+  r.milliseconds = 0;
+  for(;;)
+  {
+    ++r.milliseconds;
+    if(nextTick < r.milliseconds)
+    {
+      if(r.tick + 1 >= totalTicks)
+        break;
+      nextTickFrac += period & 0xFFFF;
+      nextTick += (period >> 16) + (nextTickFrac >> 16);
+      nextTickFrac &= 0xFFFF;
+      ++r.tick;
+      channel.tick();
+    }
+    channel.run(r.milliseconds);
+    channel.plan();
+  }
+
+  // let the last pulse finish
+  while(!r.pulses.empty() && r.pulses.back().end == r.pulses.back().start)
+    channel.run(++r.milliseconds);
+  hostSetPinHandler(NULL, NULL);
+}
+
+////////////////////////////////////////////////////////
+// Put each pulse against the nearest step of the straight
+// grid, work out how far it is from the grid and gather the
+// statistics. A step counts as missed if no pulse is put 
+// against it, so late ratchet pulses may make up for a 
+// following step that was skipped
+static void renderAnalyse(const JOB &job, int bars, RENDER &r, RESULT &result)
+{
+  long loopTicks = (long)job.steps * TICKS_PER_STEP;
+  long lastStep = -1;
+  unsigned long played = 0;
+  double total = 0;
+  memset(&result, 0, sizeof(result));
+  result.minOffset = 0;
+  result.maxOffset = 0;
+  for(size_t i = 0; i < r.pulses.size(); ++i)
+  {
+    PULSE &p = r.pulses[i];
+    long tickInLoop = p.tick % loopTicks;
+    p.step = (tickInLoop + TICKS_PER_STEP/2) / TICKS_PER_STEP;
+    p.offset = tickInLoop - (long)p.step * TICKS_PER_STEP;
+    long step = (p.tick / loopTicks) * job.steps + p.step;
+    if(step != lastStep)
+      ++played;
+    lastStep = step;
+    if(!i || p.offset < result.minOffset)
+      result.minOffset = p.offset;
+    if(!i || p.offset > result.maxOffset)
+      result.maxOffset = p.offset;
+    total += p.offset;
+    int bin = (constrain(p.offset, -TICKS_PER_STEP, TICKS_PER_STEP) + TICKS_PER_STEP) / RENDER_HIST_WIDTH;
+    ++result.hist[bin];
+  }
+  result.pulses = r.pulses.size();
+  unsigned long expected = ((long)bars * TICKS_PER_BAR / loopTicks) * job.steps;
+  result.missed = (expected > played)? expected - played : 0;
+  result.meanOffset = result.pulses? total / result.pulses : 0;
+}
+
+////////////////////////////////////////////////////////
+static std::string renderFileName(const std::string &dir, const JOB &job, const char *ext)
+{
+  char name[128];
+  int n = snprintf(name, sizeof(name), "/m%d", job.mutator);
+  for(int i = 0; i < MUTATOR_PARAMS_MAX; ++i)
+    n += snprintf(name + n, sizeof(name) - n, "_%c%d", RENDER_PARAM_FLAGS[i], job.param[i]);
+  snprintf(name + n, sizeof(name) - n, "_s%d_b%d.%s", job.steps, job.bpm, ext);
+  return dir + name;
+}
+
+////////////////////////////////////////////////////////
+static byte renderWriteVCD(const std::string &fileName, const RENDER &r)
+{
+  FILE *f = fopen(fileName.c_str(), "w");
+  if(!f)
+    return 0;
+  fprintf(f, "$timescale 1ms $end\n");
+  fprintf(f, "$scope module twister $end\n");
+  fprintf(f, "$var wire 1 ! out $end\n");
+  fprintf(f, "$upscope $end\n");
+  fprintf(f, "$enddefinitions $end\n");
+  fprintf(f, "#0\n0!\n");
+  for(size_t i = 0; i < r.pulses.size(); ++i)
+  {
+    fprintf(f, "#%lu\n1!\n", r.pulses[i].start);
+    fprintf(f, "#%lu\n0!\n", r.pulses[i].end);
+  }
+  fprintf(f, "#%lu\n", r.milliseconds);
+  return !fclose(f);
+}
+
+////////////////////////////////////////////////////////
+static byte renderWriteCSV(const std::string &fileName, const RENDER &r)
+{
+  FILE *f = fopen(fileName.c_str(), "w");
+  if(!f)
+    return 0;
+  fprintf(f, "start_ms,end_ms,tick,step,offset\n");
+  for(size_t i = 0; i < r.pulses.size(); ++i)
+  {
+    const PULSE &p = r.pulses[i];
+    fprintf(f, "%lu,%lu,%ld,%d,%d\n", p.start, p.end, p.tick, p.step, p.offset);
+  }
+  return !fclose(f);
+}
+
+////////////////////////////////////////////////////////
+//
+// SWEEP
+//
+////////////////////////////////////////////////////////
+
+struct RANGE
+{
+  int from;
+  int to;
+  int step;
+};
+
+struct OPTIONS
+{
+  RANGE mutator;
+  RANGE param[MUTATOR_PARAMS_MAX];
+  byte paramGiven[MUTATOR_PARAMS_MAX]; // otherwise each mutator's own setting is used
+  RANGE steps;
+  RANGE bpm;
+  int bars;
+  byte format;
+  int threads;
+  std::string dir;
+};
+
+////////////////////////////////////////////////////////
+// Parse "from[:to[:step]]"
+static byte parseRange(const char *s, RANGE &range)
+{
+  int n = sscanf(s, "%d:%d:%d", &range.from, &range.to, &range.step);
+  if(n < 1)
+    return 0;
+  if(n < 2)
+    range.to = range.from;
+  if(n < 3)
+    range.step = 1;
+  return range.step > 0 && range.to >= range.from;
+}
+
+////////////////////////////////////////////////////////
+static void usage()
+{
+  fprintf(stderr,
+    "usage: twister-render [options]\n"
+    "  -m RANGE   mutators (default 0:%d)\n"
+    "  -p RANGE   first mutator parameter\n"
+    "  -q RANGE   second mutator parameter\n"
+    "  -r RANGE   third mutator parameter\n"
+    "  -t RANGE   fourth mutator parameter\n"
+    "  -s RANGE   steps (default 16)\n"
+    "  -b RANGE   BPM (default 120)\n"
+    "  -n BARS    bars to render (default 4)\n"
+    "  -f FORMAT  vcd, csv or none (default none)\n"
+    "  -o DIR     output folder (default .)\n"
+    "  -j N       worker threads (default one per core)\n"
+    "A RANGE is from[:to[:step]]. Parameters are only swept for\n"
+    "mutators which use them, and default to the mutator's own\n"
+    "setting\n", MUTATOR_MAX-1);
+}
+
+////////////////////////////////////////////////////////
+// Add the settings for each value of mutator parameter i
+// and those after it
+static void buildParamJobs(const OPTIONS &opt, const RANGE *param, int i, JOB &job, std::vector<JOB> &jobs)
+{
+  if(i < MUTATOR_PARAMS_MAX)
+  {
+    for(int v = param[i].from; v <= param[i].to; v += param[i].step)
+    {
+      job.param[i] = v;
+      buildParamJobs(opt, param, i + 1, job, jobs);
+    }
+    return;
+  }
+  for(int s = opt.steps.from; s <= opt.steps.to; s += opt.steps.step)
+    for(int b = opt.bpm.from; b <= opt.bpm.to; b += opt.bpm.step)
+    {
+      job.steps = s;
+      job.bpm = b;
+      jobs.push_back(job);
+    }
+}
+
+////////////////////////////////////////////////////////
+// Build the list of settings to render
+static void buildJobs(const OPTIONS &opt, std::vector<JOB> &jobs)
+{
+  for(int m = opt.mutator.from; m <= opt.mutator.to && m < MUTATOR_MAX; m += opt.mutator.step)
+  {
+    CSynchChannel channel;
+    channel.setParam(CSynchChannel::PARAM_MUTATION, m);
+    CMutator *mutator = channel.getMutator();
+    RANGE param[MUTATOR_PARAMS_MAX];
+    for(int i = 0; i < MUTATOR_PARAMS_MAX; ++i)
+    {
+      if(i < mutator->getNumParams() && opt.paramGiven[i])
+      {
+        param[i] = opt.param[i];
+      }
+      else
+      {
+        int v = (i < mutator->getNumParams())? mutator->getParam(i) : 0;
+        param[i].from = param[i].to = v;
+        param[i].step = 1;
+      }
+    }
+    JOB job;
+    job.mutator = m;
+    buildParamJobs(opt, param, 0, job, jobs);
+  }
+}
+
+////////////////////////////////////////////////////////
+// Worker thread.. take the next setting from the queue
+// until there are none left
+static void worker(const OPTIONS &opt, const std::vector<JOB> &jobs,
+  std::vector<RESULT> &results, std::atomic<size_t> &next)
+{
+  // channels are reused as they don't free their mutators
+  CSynchChannel channel;
+  channel.setOutputPin(P_CLKOUT0);
+  size_t i;
+  while((i = next++) < jobs.size())
+  {
+    RENDER r;
+    renderChannel(channel, jobs[i], opt.bars, r);
+    renderAnalyse(jobs[i], opt.bars, r, results[i]);
+    switch(opt.format)
+    {
+    case FORMAT_VCD:
+      results[i].failed = !renderWriteVCD(renderFileName(opt.dir, jobs[i], "vcd"), r);
+      break;
+    case FORMAT_CSV:
+      results[i].failed = !renderWriteCSV(renderFileName(opt.dir, jobs[i], "csv"), r);
+      break;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////
+static byte writeSummary(const OPTIONS &opt, const std::vector<JOB> &jobs, const std::vector<RESULT> &results)
+{
+  std::string fileName = opt.dir + "/summary.csv";
+  FILE *f = fopen(fileName.c_str(), "w");
+  if(!f)
+    return 0;
+  fprintf(f, "mutator");
+  for(int i = 0; i < MUTATOR_PARAMS_MAX; ++i)
+    fprintf(f, ",param%d", i + 1);
+  fprintf(f, ",steps,bpm,pulses,missed,min_offset,max_offset,mean_offset");
+  for(int b = 0; b < RENDER_HIST_BINS; ++b)
+    fprintf(f, ",hist%+d", b * RENDER_HIST_WIDTH - TICKS_PER_STEP);
+  fprintf(f, "\n");
+  for(size_t i = 0; i < jobs.size(); ++i)
+  {
+    const JOB &job = jobs[i];
+    const RESULT &result = results[i];
+    fprintf(f, "%d", job.mutator);
+    for(int p = 0; p < MUTATOR_PARAMS_MAX; ++p)
+      fprintf(f, ",%d", job.param[p]);
+    fprintf(f, ",%d,%d,%lu,%lu,%ld,%ld,%.3f", job.steps, job.bpm,
+      result.pulses, result.missed, result.minOffset, result.maxOffset, result.meanOffset);
+    for(int b = 0; b < RENDER_HIST_BINS; ++b)
+      fprintf(f, ",%lu", result.hist[b]);
+    fprintf(f, "\n");
+  }
+  return !fclose(f);
+}
+
+////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+  OPTIONS opt;
+  opt.mutator.from = 0;
+  opt.mutator.to = MUTATOR_MAX-1;
+  opt.mutator.step = 1;
+  for(int p = 0; p < MUTATOR_PARAMS_MAX; ++p)
+    opt.paramGiven[p] = 0;
+  parseRange("16", opt.steps);
+  parseRange("120", opt.bpm);
+  opt.bars = 4;
+  opt.format = FORMAT_NONE;
+  opt.threads = std::thread::hardware_concurrency();
+  opt.dir = ".";
+
+  for(int i = 1; i < argc; ++i)
+  {
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc)? argv[i + 1] : NULL;
+    byte ok = (val != NULL);
+    const char *paramFlag = (arg[0] == '-' && arg[1] && !arg[2])? strchr(RENDER_PARAM_FLAGS, arg[1]) : NULL;
+    if(!strcmp(arg, "-m") && ok)      ok = parseRange(val, opt.mutator);
+    else if(paramFlag && ok)
+    {
+      int p = paramFlag - RENDER_PARAM_FLAGS;
+      ok = opt.paramGiven[p] = parseRange(val, opt.param[p]);
+    }
+    else if(!strcmp(arg, "-s") && ok) ok = parseRange(val, opt.steps);
+    else if(!strcmp(arg, "-b") && ok) ok = parseRange(val, opt.bpm);
+    else if(!strcmp(arg, "-n") && ok) ok = ((opt.bars = atoi(val)) > 0);
+    else if(!strcmp(arg, "-j") && ok) ok = ((opt.threads = atoi(val)) > 0);
+    else if(!strcmp(arg, "-o") && ok) opt.dir = val;
+    else if(!strcmp(arg, "-f") && ok)
+    {
+      if(!strcmp(val, "vcd"))       opt.format = FORMAT_VCD;
+      else if(!strcmp(val, "csv"))  opt.format = FORMAT_CSV;
+      else if(!strcmp(val, "none")) opt.format = FORMAT_NONE;
+      else ok = 0;
+    }
+    else
+      ok = 0;
+    if(!ok)
+    {
+      usage();
+      return 1;
+    }
+    ++i;
+  }
+  if(opt.steps.from < 1 || opt.bpm.from < 1)
+  {
+    usage();
+    return 1;
+  }
+  if(opt.threads < 1)
+    opt.threads = 1;
+
+  std::vector<JOB> jobs;
+  buildJobs(opt, jobs);
+  std::vector<RESULT> results(jobs.size());
+  std::atomic<size_t> next(0);
+
+  struct timespec started, finished;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  std::vector<std::thread> threads;
+  for(int t = 0; t < opt.threads; ++t)
+    threads.push_back(std::thread(worker, std::cref(opt), std::cref(jobs), std::ref(results), std::ref(next)));
+  for(size_t t = 0; t < threads.size(); ++t)
+    threads[t].join();
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+
+  unsigned long failed = 0;
+  for(size_t i = 0; i < results.size(); ++i)
+    failed += results[i].failed;
+  if(failed)
+    fprintf(stderr, "twister-render: could not write %lu timing files\n", failed);
+  if(!writeSummary(opt, jobs, results))
+  {
+    fprintf(stderr, "twister-render: could not write %s/summary.csv\n", opt.dir.c_str());
+    return 1;
+  }
+  double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+  printf("rendered %lu settings on %d threads in %.2fs\n", (unsigned long)jobs.size(), opt.threads, seconds);
+  return failed? 1 : 0;
+}
@@ -0,0 +1,322 @@
+////////////////////////////////////////////////////////
+//
+// C H A N N E L   T E S T
+//
+// Plays a single channel the way synchRun() does, one
+// pass per millisecond, and checks its pulses in ticks:
+//
+// - gates given as a fraction of the step, or in ticks,
+//   come out the right length, and are cut short to leave
+//   the recovery time before the next step
+// - Prb plays the steps it chooses, and its ratchets never
+//   hold up the step after them
+// - a channel restarted part way through its loop plays on
+//   just as if it had played from the start
+//
+// Build from this folder with
+//
+//   g++ -std=c++11 -I../HostArduino -I../../Synch_Twister -o channel-test ChannelTest.cpp
+//     ../HostArduino/HostArduino.cpp
+//
+// (all on one line)
+//
+////////////////////////////////////////////////////////
+#include <vector>
+#include "TwisterTest.h"
+#include "Arduino.h"
+#include "TinyUI.h"
+#include "Synch_Twister.h"
+#include "Mutators.h"
+#include "SynchChannel.h"
+
+struct PULSE
+{
+  long start;   // tick the pulse started on
+  long end;     // tick it ended on (-1 while it is still going)
+};
+
+struct PLAY
+{
+  std::vector<PULSE> pulses;
+  long tick;
+};
+
+////////////////////////////////////////////////////////
+static void playPin(void *context, byte pin, byte value)
+{
+  PLAY *play = (PLAY*)context;
+  if(HIGH == value)
+  {
+    PULSE p = { play->tick, -1 };
+    play->pulses.push_back(p);
+  }
+  else if(!play->pulses.empty() && play->pulses.back().end < 0)
+  {
+    play->pulses.back().end = play->tick;
+  }
+}
+
+////////////////////////////////////////////////////////
+// Play a channel at a tempo from a tick position in its 
+// loop, up to a tick
+static void playChannel(CSynchChannel &channel, double bpm, long ticks, PLAY &play, long position = 0)
+{
+  unsigned long period = SYNCH_PERIOD_BPM/bpm + 0.5;
+  channel.setOutputPin(P_CLKOUT0);
+  channel.setTickPeriod(period);
+  channel.reset();
+  if(position)
+  {
+    // the main loop gets a tick to catch up the plan, as 
+    // it does when the channels are realigned
+    channel.restart(position);
+    channel.plan();
+  }
+  play.pulses.clear();
+  play.tick = position - 1;
+  hostSetPinHandler(playPin, &play);
+  unsigned long nextTick = 0;
+  unsigned long nextTickFrac = 0;
+  for(unsigned long ms = 1; ; ++ms)
+  {
+    if(nextTick < ms)
+    {
+      if(play.tick + 1 >= ticks)
+        break;
+      nextTickFrac += period & 0xFFFF;
+      nextTick += (period >> 16) + (nextTickFrac >> 16);
+      nextTickFrac &= 0xFFFF;
+      ++play.tick;
+      channel.tick();
+    }
+    channel.run(ms);
+    channel.plan();
+  }
+  hostSetPinHandler(NULL, NULL);
+}
+
+////////////////////////////////////////////////////////
+// Every step of a straight loop plays once, on the grid
+static void checkOnGrid(const PLAY &play, long ticks, const char *what)
+{
+  bool onGrid = true;
+  for(unsigned int i = 0; i < play.pulses.size(); ++i)
+    if(play.pulses[i].start != (long)i * TICKS_PER_STEP)
+      onGrid = false;
+  testCheck(onGrid, what, __FILE__, __LINE__);
+  testCheck(play.pulses.size() == (unsigned long)(ticks / TICKS_PER_STEP), what, __FILE__, __LINE__);
+}
+
+////////////////////////////////////////////////////////
+// All but the last pulse (which may still be going) are
+// the given number of ticks long
+static void checkGate(const PLAY &play, long gate, const char *what)
+{
+  bool ok = play.pulses.size() > 1;
+  for(unsigned int i = 0; i + 1 < play.pulses.size(); ++i)
+    if(play.pulses[i].end - play.pulses[i].start != gate)
+      ok = false;
+  testCheck(ok, what, __FILE__, __LINE__);
+}
+
+////////////////////////////////////////////////////////
+// Gates as a percentage of the step are rounded to the
+// nearest tick, and leave the recovery time clear
+static void testStepGate()
+{
+  CSynchChannel channel;
+  channel.setParam(CSynchChannel::PARAM_GATEMODE, CSynchChannel::GATE_STEP);
+  channel.setParam(CSynchChannel::PARAM_RECOVERMS, 10);
+  long ticks = 8 * TICKS_PER_BEAT;
+  // 120 BPM.. a tick is 5.2ms, so the recovery takes 3 ticks
+  long room = TICKS_PER_STEP - 3;
+  for(int percent = 1; percent <= 99; ++percent)
+  {
+    channel.setParam(CSynchChannel::PARAM_PULSEMS, percent);
+    PLAY play;
+    playChannel(channel, 120, ticks, play);
+    long gate = (TICKS_PER_STEP * percent + 50) / 100;
+    gate = constrain(gate, 1, room);
+    char what[80];
+    snprintf(what, sizeof(what), "%d%% of the step", percent);
+    checkOnGrid(play, ticks, what);
+    checkGate(play, gate, what);
+  }
+}
+
+////////////////////////////////////////////////////////
+// Gates in ticks are as long as asked, and are also cut
+// short before the next step
+static void testTickGate()
+{
+  CSynchChannel channel;
+  channel.setParam(CSynchChannel::PARAM_GATEMODE, CSynchChannel::GATE_TICKS);
+  channel.setParam(CSynchChannel::PARAM_RECOVERMS, 10);
+  long ticks = 8 * TICKS_PER_BEAT;
+  long room = TICKS_PER_STEP - 3;
+  for(int gate = 1; gate <= 40; ++gate)
+  {
+    channel.setParam(CSynchChannel::PARAM_PULSEMS, gate);
+    PLAY play;
+    playChannel(channel, 120, ticks, play);
+    char what[80];
+    snprintf(what, sizeof(what), "gate of %d ticks", gate);
+    checkOnGrid(play, ticks, what);
+    checkGate(play, min(gate, room), what);
+  }
+}
+
+////////////////////////////////////////////////////////
+// Start ticks of the first pulse of each step that played
+static std::vector<long> stepStarts(const PLAY &play)
+{
+  std::vector<long> starts;
+  long lastStep = -1;
+  for(unsigned int i = 0; i < play.pulses.size(); ++i)
+  {
+    long step = play.pulses[i].start / TICKS_PER_STEP;
+    if(step != lastStep)
+      starts.push_back(play.pulses[i].start);
+    lastStep = step;
+  }
+  return starts;
+}
+
+////////////////////////////////////////////////////////
+// Set up Prb to play every step, with a given chance of 
+// a ratchet
+static void setChance(CSynchChannel &channel, int ratchets, int ratchetChance)
+{
+  channel.setParam(CSynchChannel::PARAM_MUTATION, MUTATOR_CHANCE);
+  CMutator *m = channel.getMutator();
+  m->setParam(0, 100);
+  m->setParam(1, ratchets);
+  m->setParam(2, ratchetChance);
+  m->setParam(3, 1);
+}
+
+////////////////////////////////////////////////////////
+// Wherever a single pulse and its recovery fit in a step, 
+// a step ratcheted as far as it will go still leaves the
+// next step on the grid
+static void testRatchetsOnGrid()
+{
+  static const double bpms[] = { 20, 40, 60, 90, 120, 150, 200, 250, 300, 350 };
+  static const int pulseTimes[] = { 1, 2, 5, 10, 15, 25, 40, 60, 99 };
+  static const int recoverTimes[] = { 1, 2, 5, 10, 20, 43, 70, 99 };
+  long ticks = 4 * TICKS_PER_BAR;
+  int cases = 0;
+  for(int mode = 0; mode < CSynchChannel::GATE_MAX; ++mode)
+    for(unsigned int b = 0; b < sizeof(bpms)/sizeof(bpms[0]); ++b)
+      for(unsigned int p = 0; p < sizeof(pulseTimes)/sizeof(pulseTimes[0]); ++p)
+        for(unsigned int r = 0; r < sizeof(recoverTimes)/sizeof(recoverTimes[0]); ++r)
+        {
+          CSynchChannel channel;
+          channel.setParam(CSynchChannel::PARAM_GATEMODE, mode);
+          channel.setParam(CSynchChannel::PARAM_PULSEMS, pulseTimes[p]);
+          channel.setParam(CSynchChannel::PARAM_RECOVERMS, recoverTimes[r]);
+          PLAY play;
+          setChance(channel, 8, 0);
+          playChannel(channel, bpms[b], ticks, play);
+          std::vector<long> single = stepStarts(play);
+          bool fits = true;
+          for(unsigned int i = 0; i < single.size(); ++i)
+            if(single[i] != (long)i * TICKS_PER_STEP)
+              fits = false;
+          if(!fits || single.size() != (unsigned long)(ticks / TICKS_PER_STEP))
+            continue;
+
+          setChance(channel, 8, 100);
+          playChannel(channel, bpms[b], ticks, play);
+          char what[100];
+          snprintf(what, sizeof(what), "gate mode %d, %g BPM, pulse %d, recovery %d: ratchets keep to the grid",
+            mode, bpms[b], pulseTimes[p], recoverTimes[r]);
+          testCheck(stepStarts(play) == single, what, __FILE__, __LINE__);
+          ++cases;
+        }
+  CHECK(cases > 100);
+}
+
+////////////////////////////////////////////////////////
+// Eight ratchets, a 1ms pulse and a 43ms recovery at 40
+// BPM only just fit. Step 1 must still land on tick 24
+static void testRatchetExample()
+{
+  CSynchChannel channel;
+  channel.setParam(CSynchChannel::PARAM_PULSEMS, 1);
+  channel.setParam(CSynchChannel::PARAM_RECOVERMS, 43);
+  setChance(channel, 8, 100);
+  PLAY play;
+  playChannel(channel, 40, 2 * TICKS_PER_STEP, play);
+  std::vector<long> starts = stepStarts(play);
+  CHECK(starts.size() == 2);
+  CHECK(starts.size() == 2 && TICKS_PER_STEP == starts[1]);
+  CHECK(play.pulses.size() > 2);
+}
+
+////////////////////////////////////////////////////////
+// Prb with a seed plays the same steps every loop
+static void testChanceRepeats()
+{
+  CSynchChannel channel;
+  channel.setParam(CSynchChannel::PARAM_STEPS, 16);
+  setChance(channel, 2, 0);
+  channel.getMutator()->setParam(0, 50);
+  channel.getMutator()->setParam(3, 7);
+  PLAY play;
+  long loopTicks = 16 * TICKS_PER_STEP;
+  playChannel(channel, 120, 4 * loopTicks, play);
+  std::vector<long> loops[4];
+  for(unsigned int i = 0; i < play.pulses.size(); ++i)
+    loops[play.pulses[i].start / loopTicks].push_back(play.pulses[i].start % loopTicks);
+  CHECK(loops[0].size() > 2 && loops[0].size() < 14);
+  CHECK(loops[1] == loops[0]);
+  CHECK(loops[2] == loops[0]);
+  CHECK(loops[3] == loops[0]);
+}
+
+////////////////////////////////////////////////////////
+// Prb restarted part way through its loop draws the steps
+// it passes over, so it plays the same steps as the loop
+// played from the start (less the rest of any ratchet it
+// lands in)
+static void testRestartChance()
+{
+  long loopTicks = 16 * TICKS_PER_STEP;
+  for(int seed = 1; seed <= 20; ++seed)
+  {
+    CSynchChannel channel;
+    channel.setParam(CSynchChannel::PARAM_STEPS, 16);
+    setChance(channel, 4, 30);
+    channel.getMutator()->setParam(0, 50);
+    channel.getMutator()->setParam(3, seed);
+    PLAY whole;
+    playChannel(channel, 120, 2 * loopTicks, whole);
+    for(long position = TICKS_PER_STEP; position < loopTicks; position += 3 * TICKS_PER_STEP + 5)
+    {
+      PLAY part;
+      playChannel(channel, 120, 2 * loopTicks, part, position);
+      std::vector<long> expected, played;
+      for(unsigned int i = 0; i < whole.pulses.size(); ++i)
+        if(whole.pulses[i].start / TICKS_PER_STEP * TICKS_PER_STEP >= position)
+          expected.push_back(whole.pulses[i].start);
+      for(unsigned int i = 0; i < part.pulses.size(); ++i)
+        played.push_back(part.pulses[i].start);
+      char what[80];
+      snprintf(what, sizeof(what), "Prb seed %d restarted at tick %ld", seed, position);
+      testCheck(played == expected, what, __FILE__, __LINE__);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////
+int main()
+{
+  testStepGate();
+  testTickGate();
+  testRatchetsOnGrid();
+  testRatchetExample();
+  testChanceRepeats();
+  testRestartChance();
+  return testResult("ChannelTest");
+}
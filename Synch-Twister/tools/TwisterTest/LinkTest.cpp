@@ -0,0 +1,213 @@
+////////////////////////////////////////////////////////
+//
+// L I N K   T E S T
+//
+// Runs two copies of the sketch, each in its own process,
+// joined by a pty pair standing in for the UART link. One
+// is the leader at 133 BPM, the other starts at 111 BPM
+// with a clock that runs 0.2% fast from a different start
+// time, and follows the link. Both play a swung 5 step
+// loop on channel 0, which does not divide the bar. The
+// follower joins a few bars after the leader starts
+// sending, so it has to pick up the leader's loop part way
+// through.
+//
+// Time is virtual, and moved on in lockstep by this
+// process in 250us steps, so the result does not depend
+// on how the processes are scheduled. Once the follower
+// has settled, every bar start and every channel 0 pulse
+// on one unit must be within a tick of the same on the
+// other.
+//
+// Build from this folder with
+//
+//   g++ -std=c++11 -I../HostArduino -I../../Synch_Twister -o link-test LinkTest.cpp ../HostArduino/HostArduino.cpp
+//     ../../Synch_Twister/TinyUI.cpp ../../Synch_Twister/Health.cpp -lutil
+//
+// (all on one line)
+//
+////////////////////////////////////////////////////////
+#include <fcntl.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include "TwisterTest.h"
+
+#include "Arduino.h"
+#include "Synch_Twister.ino"
+
+#define TEST_STEP_US        250
+#define TEST_LEAD_US        3000000ULL    // when the leader starts sending
+#define TEST_FOLLOW_US      8000000ULL    // when the follower starts following
+#define TEST_SETTLE_US      15000000ULL   // when the follower should be in step
+#define TEST_END_US         45000000ULL
+#define TEST_LEADER_BPM     133
+#define TEST_FOLLOWER_BPM   111
+#define TEST_FOLLOWER_SKEW  1.002         // follower's clock against true time
+#define TEST_FOLLOWER_START 12345678UL    // follower's clock at true time 0 (us)
+
+// events seen in a step
+enum {
+  EVENT_BAR   = 0x01,   // first tick of a bar
+  EVENT_PULSE = 0x02    // channel 0 pulse started
+};
+
+static byte unitEvents;
+
+////////////////////////////////////////////////////////
+static void unitPin(void *context, byte pin, byte value)
+{
+  if(P_CLKOUT0 == pin && HIGH == value)
+    unitEvents |= EVENT_PULSE;
+}
+
+////////////////////////////////////////////////////////
+// Run one unit in a child process. Each true time read
+// from cmdFD is one step, answered on replyFD with the
+// events seen in it. Returns when cmdFD is closed
+static void runUnit(int serialFD, int cmdFD, int replyFD, byte leader)
+{
+  double skew = leader? 1.0 : TEST_FOLLOWER_SKEW;
+  unsigned long start = leader? 0 : TEST_FOLLOWER_START;
+  hostMicros = start;
+  Serial.setFD(serialFD);
+  setup();
+  synchSetBPM(leader? TEST_LEADER_BPM : TEST_FOLLOWER_BPM);
+  synchChannels[0].setParam(CSynchChannel::PARAM_MUTATION, MUTATOR_SHUFFLE);
+  synchChannels[0].getMutator()->setParam(0, 75);
+  synchChannels[0].setParam(CSynchChannel::PARAM_STEPS, 5);
+  hostSetPinHandler(unitPin, NULL);
+
+  unsigned long long trueMicros;
+  while(read(cmdFD, &trueMicros, sizeof(trueMicros)) == sizeof(trueMicros))
+  {
+    // the two units run on their own until then, and will
+    // be out of step by the time they are linked
+    if(leader && TEST_LEAD_US == trueMicros)
+      linkSetLeader(1);
+    if(!leader && TEST_FOLLOW_US == trueMicros)
+      synchSetSource(SYNCH_SOURCE_LINK);
+    hostMicros = start + (unsigned long)(trueMicros * skew);
+    unitEvents = 0;
+    unsigned int barTick = synchBarTick;
+    loop();
+    if(!barTick && 1 == synchBarTick)
+      unitEvents |= EVENT_BAR;
+    if(write(replyFD, &unitEvents, 1) != 1)
+      break;
+  }
+}
+
+////////////////////////////////////////////////////////
+// A unit as seen from this process
+struct UNIT
+{
+  pid_t pid;
+  int cmdFD;
+  int replyFD;
+  std::vector<unsigned long long> bars;
+  std::vector<unsigned long long> pulses;
+};
+
+////////////////////////////////////////////////////////
+static bool startUnit(UNIT &unit, int serialFD, int otherFD, byte leader)
+{
+  int cmd[2], reply[2];
+  if(pipe(cmd) < 0 || pipe(reply) < 0)
+    return false;
+  unit.pid = fork();
+  if(unit.pid < 0)
+    return false;
+  if(!unit.pid)
+  {
+    close(otherFD);
+    close(cmd[1]);
+    close(reply[0]);
+    runUnit(serialFD, cmd[0], reply[1], leader);
+    _exit(0);
+  }
+  close(cmd[0]);
+  close(reply[1]);
+  unit.cmdFD = cmd[1];
+  unit.replyFD = reply[0];
+  return true;
+}
+
+////////////////////////////////////////////////////////
+static bool stepUnit(UNIT &unit, unsigned long long trueMicros)
+{
+  byte events;
+  if(write(unit.cmdFD, &trueMicros, sizeof(trueMicros)) != sizeof(trueMicros) ||
+    read(unit.replyFD, &events, 1) != 1)
+    return false;
+  if(events & EVENT_BAR)
+    unit.bars.push_back(trueMicros);
+  if(events & EVENT_PULSE)
+    unit.pulses.push_back(trueMicros);
+  return true;
+}
+
+////////////////////////////////////////////////////////
+// Every event in a, once settled, must have one in b
+// within a tick
+static void checkInStep(const std::vector<unsigned long long> &a,
+  const std::vector<unsigned long long> &b, const char *what)
+{
+  double tick = 60000000.0 / TEST_LEADER_BPM / TICKS_PER_BEAT;
+  int count = 0;
+  for(unsigned int i = 0; i < a.size(); ++i)
+  {
+    // leave room at the end for the other unit's event
+    if(a[i] < TEST_SETTLE_US || a[i] > TEST_END_US - 1000000)
+      continue;
+    double nearest = 1e9;
+    for(unsigned int j = 0; j < b.size(); ++j)
+      nearest = min(nearest, fabs((double)b[j] - (double)a[i]));
+    testCheckNear(nearest, 0, tick, what, __FILE__, __LINE__);
+    ++count;
+  }
+  testCheck(count > 10, what, __FILE__, __LINE__);
+}
+
+////////////////////////////////////////////////////////
+int main()
+{
+  // the link, with no line discipline getting in the way
+  int leaderFD, followerFD;
+  if(openpty(&leaderFD, &followerFD, NULL, NULL, NULL) < 0)
+  {
+    perror("openpty");
+    return 1;
+  }
+  struct termios raw;
+  tcgetattr(followerFD, &raw);
+  cfmakeraw(&raw);
+  tcsetattr(followerFD, TCSANOW, &raw);
+  fcntl(leaderFD, F_SETFL, fcntl(leaderFD, F_GETFL) | O_NONBLOCK);
+  fcntl(followerFD, F_SETFL, fcntl(followerFD, F_GETFL) | O_NONBLOCK);
+
+  UNIT leader, follower;
+  if(!startUnit(leader, leaderFD, followerFD, 1) ||
+    !startUnit(follower, followerFD, leaderFD, 0))
+  {
+    perror("fork");
+    return 1;
+  }
+
+  bool ok = true;
+  for(unsigned long long t = 0; ok && t < TEST_END_US; t += TEST_STEP_US)
+    ok = stepUnit(leader, t) && stepUnit(follower, t);
+  CHECK(ok);
+  close(leader.cmdFD);
+  close(follower.cmdFD);
+  waitpid(leader.pid, NULL, 0);
+  waitpid(follower.pid, NULL, 0);
+
+  checkInStep(leader.bars, follower.bars, "follower bar start in step with leader");
+  checkInStep(follower.bars, leader.bars, "leader bar start in step with follower");
+  checkInStep(leader.pulses, follower.pulses, "follower 5 step pulse in step with leader");
+  checkInStep(follower.pulses, leader.pulses, "leader 5 step pulse in step with follower");
+  return testResult("LinkTest");
+}
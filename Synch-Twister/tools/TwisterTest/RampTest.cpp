@@ -0,0 +1,161 @@
+////////////////////////////////////////////////////////
+//
+// R A M P   T E S T
+//
+// Runs the sketch's tick engine through linear and
+// exponential tempo ramps, up and down, from one beat to
+// the longest of 99 beats, and checks that:
+//
+// - a ramp takes exactly its length in ticks, so the bar
+//   position comes out where it would with no ramp
+// - the ramp lands exactly on the target period and
+//   stays there
+// - every tick along the way is close to the ideal curve
+//   (linear ramps to within one unit of the 16.16 period)
+// - the ramp takes as long as the ideal curve says
+// - changing the shape during a ramp leaves it alone
+//
+// Build from this folder with
+//
+//   g++ -std=c++11 -I../HostArduino -I../../Synch_Twister -o ramp-test RampTest.cpp ../HostArduino/HostArduino.cpp
+//     ../../Synch_Twister/TinyUI.cpp ../../Synch_Twister/Health.cpp
+//
+// (all on one line)
+//
+////////////////////////////////////////////////////////
+#include "TwisterTest.h"
+
+#include "Arduino.h"
+#include "Synch_Twister.ino"
+
+////////////////////////////////////////////////////////
+// Run the tick engine until the next tick. Returns the
+// millisecond it happened on
+static unsigned long runToTick()
+{
+  unsigned int barTick = synchBarTick;
+  while(barTick == synchBarTick)
+  {
+    hostMicros += 1000;
+    synchRun(millis());
+  }
+  return millis();
+}
+
+////////////////////////////////////////////////////////
+static void testRamp(byte shape, byte beats, double fromBPM, double toBPM)
+{
+  synchSetBPM(fromBPM);
+  synchRampShape = shape;
+  synchRampBeats = beats;
+  runToTick();
+
+  // start the ramp just after a tick, as the menu would
+  unsigned int startBarTick = synchBarTick;
+  double from = synchTickPeriod;
+  synchRampBPM(toBPM);
+  unsigned long target = synchRampTarget;
+  CHECK(target == (unsigned long)(SYNCH_PERIOD_BPM/toBPM + 0.5));
+
+  long rampTicks = (long)beats * TICKS_PER_BEAT;
+  long ticks = 0;
+  double worstError = 0;
+  double idealTime = 0;     // ms from the start tick to the last tick of the ramp
+  unsigned long startTime = millis();
+  unsigned long endTime = startTime;
+  while(synchRampTicksLeft && ticks <= rampTicks)
+  {
+    // the tick before this one was spaced by the period then
+    double k = ticks;
+    double ideal = (SYNCH_RAMP_LINEAR == shape)?
+      from + (target - from) * k / rampTicks :
+      from * pow(target / from, k / rampTicks);
+    idealTime += ideal / 65536.0;
+    endTime = runToTick();
+    ++ticks;
+
+    k = ticks;
+    ideal = (SYNCH_RAMP_LINEAR == shape)?
+      from + (target - from) * k / rampTicks :
+      from * pow(target / from, k / rampTicks);
+    double error = fabs(synchTickPeriod - ideal);
+    if(SYNCH_RAMP_EXPONENTIAL == shape)
+      error /= ideal;
+    if(error > worstError)
+      worstError = error;
+  }
+
+  char what[80];
+  snprintf(what, sizeof(what), "%s ramp of %d beats from %g to %g BPM",
+    (SYNCH_RAMP_LINEAR == shape)? "linear" : "exponential", beats, fromBPM, toBPM);
+  testCheck(ticks == rampTicks, what, __FILE__, __LINE__);
+  testCheck(synchBarTick == (startBarTick + rampTicks) % TICKS_PER_BAR, what, __FILE__, __LINE__);
+  testCheck(synchTickPeriod == target, what, __FILE__, __LINE__);
+  if(SYNCH_RAMP_LINEAR == shape)
+    testCheckNear(worstError, 0, 1.0, what, __FILE__, __LINE__);
+  else
+    testCheckNear(worstError, 0, 0.0005, what, __FILE__, __LINE__);
+  // each tick lands on a whole millisecond, up to 1ms after its time
+  testCheckNear(endTime - startTime, idealTime, max(2.0, idealTime * 0.0005), what, __FILE__, __LINE__);
+
+  // and carries on at the target tempo
+  for(int i = 0; i < TICKS_PER_BEAT; ++i)
+    runToTick();
+  testCheck(synchTickPeriod == target, what, __FILE__, __LINE__);
+}
+
+////////////////////////////////////////////////////////
+// Changing the shape on the menu part way through a ramp
+// only affects the next ramp. The one running keeps to
+// its own shape, and not the steps left by an older ramp
+static void testShapeChange()
+{
+  synchSetBPM(350);
+  synchRampShape = SYNCH_RAMP_EXPONENTIAL;
+  synchRampBeats = 1;
+  synchRampBPM(40);
+  while(synchRampTicksLeft)
+    runToTick();
+
+  synchSetBPM(120);
+  synchRampShape = SYNCH_RAMP_LINEAR;
+  synchRampBeats = 8;
+  runToTick();
+  unsigned long from = synchTickPeriod;
+  synchRampBPM(121);
+  unsigned long target = synchRampTarget;
+  long ticks = 0;
+  bool inRange = true;
+  while(synchRampTicksLeft && ticks <= 8 * TICKS_PER_BEAT)
+  {
+    if(10 == ticks)
+      synchRampShape = SYNCH_RAMP_EXPONENTIAL;
+    runToTick();
+    ++ticks;
+    if(synchTickPeriod > from || synchTickPeriod < target)
+    {
+      inRange = false;
+      break;
+    }
+  }
+  CHECK(inRange);
+  CHECK(ticks == 8 * TICKS_PER_BEAT);
+  CHECK(synchTickPeriod == target);
+  synchRampShape = SYNCH_RAMP_LINEAR;
+}
+
+////////////////////////////////////////////////////////
+int main()
+{
+  static const byte beats[] = { 1, 4, 8, 33, 99 };
+  static const double tempo[][2] = {
+    { 120, 180 }, { 180, 60 }, { 40, 350 }, { 350, 40 }, { 120, 121 }, { 121, 120 }
+  };
+  setup();
+  for(byte shape = 0; shape < SYNCH_RAMP_MAX; ++shape)
+    for(unsigned int i = 0; i < sizeof(beats)/sizeof(beats[0]); ++i)
+      for(unsigned int j = 0; j < sizeof(tempo)/sizeof(tempo[0]); ++j)
+        testRamp(shape, beats[i], tempo[j][0], tempo[j][1]);
+  testShapeChange();
+  return testResult("RampTest");
+}
@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////
+//
+// S O N G   T E S T
+//
+// Runs the sketch's main loop with patterns stored in
+// three slots, each telling itself apart by the number of
+// steps on channel 0, and checks that:
+//
+// - a slot with nothing stored in it can't be chained
+// - each chain entry plays for its number of bars, and
+//   patterns change only at the start of a bar
+// - storing a pattern and adding it to the chain while 
+//   the song plays never makes the main loop wait for the
+//   EEPROM
+// - stored slots are still marked after a restart
+//
+// Build from this folder with
+//
+//   g++ -std=c++11 -I../HostArduino -I../../Synch_Twister -o song-test SongTest.cpp ../HostArduino/HostArduino.cpp
+//     ../../Synch_Twister/TinyUI.cpp ../../Synch_Twister/Health.cpp
+//
+// (all on one line)
+//
+////////////////////////////////////////////////////////
+#include <vector>
+#include "TwisterTest.h"
+
+#include "Arduino.h"
+#include "Synch_Twister.ino"
+
+#define TEST_STEP_US    250
+#define TEST_BPM        120
+
+static std::vector<int> testBars;   // channel 0 steps at the start of each bar
+static bool testOffBar;             // set if a pattern changed part way through a bar
+
+////////////////////////////////////////////////////////
+// Run the main loop until the next tick, noting the 
+// pattern at the start of each bar
+static void runTick()
+{
+  int steps = synchChannels[0].getParam(CSynchChannel::PARAM_STEPS);
+  unsigned int barTick = synchBarTick;
+  while(barTick == synchBarTick)
+  {
+    hostMicros += TEST_STEP_US;
+    loop();
+  }
+  // the bar tick has just been played
+  if(synchChannels[0].getParam(CSynchChannel::PARAM_STEPS) != steps && 1 != synchBarTick)
+    testOffBar = true;
+  if(1 == synchBarTick)
+    testBars.push_back(synchChannels[0].getParam(CSynchChannel::PARAM_STEPS));
+}
+
+////////////////////////////////////////////////////////
+static void runBars(int bars)
+{
+  for(long i = 0; i < (long)bars * TICKS_PER_BAR; ++i)
+    runTick();
+}
+
+////////////////////////////////////////////////////////
+// Store the channels in a slot, with a given number of 
+// steps on channel 0
+static void storePattern(byte slot, int steps)
+{
+  synchChannels[0].setParam(CSynchChannel::PARAM_STEPS, steps);
+  CHECK(songStorePattern(slot));
+}
+
+////////////////////////////////////////////////////////
+// The bars played from the first bar of a given pattern
+// must repeat the expected run of bars
+static void checkBars(const int *expected, int count, int bars, const char *what)
+{
+  unsigned int i = 0;
+  while(i < testBars.size() && testBars[i] != expected[0])
+    ++i;
+  bool ok = testBars.size() >= i + bars;
+  for(int j = 0; ok && j < bars; ++j)
+    if(testBars[i + j] != expected[j % count])
+      ok = false;
+  testCheck(ok, what, __FILE__, __LINE__);
+}
+
+////////////////////////////////////////////////////////
+static void testEmptySlot()
+{
+  // blank EEPROM
+  CHECK(!songChainLength);
+  songAppend(4);
+  CHECK(!songChainLength);
+  storePattern(4, 9);
+  songAppend(4);
+  CHECK(1 == songChainLength);
+  songRemove();
+  CHECK(!songChainLength);
+  runBars(1);
+  CHECK(!songFlush);
+}
+
+////////////////////////////////////////////////////////
+static void testSongPlays()
+{
+  storePattern(0, 3);
+  runBars(1);
+  storePattern(1, 5);
+  songAppend(0);
+  songAppend(0);
+  songAppend(1);
+  songAppend(1);
+  songAppend(1);
+  CHECK(2 == songChainLength);
+  runBars(1);
+  CHECK(!songFlush);
+
+  testBars.clear();
+  testOffBar = false;
+  songPlay(1);
+  runBars(12);
+  static const int expected[] = { 3, 3, 5, 5, 5 };
+  checkBars(expected, 5, 10, "two bars of slot 0 then three of slot 1");
+  CHECK(!testOffBar);
+}
+
+////////////////////////////////////////////////////////
+static void testEditWhilePlaying()
+{
+  // half way through a bar
+  for(int i = 0; i < TICKS_PER_BAR/2; ++i)
+    runTick();
+  storePattern(2, 7);
+  songAppend(2);
+  songAppend(1);
+  songAppend(1);
+  CHECK(4 == songChainLength);
+
+  testBars.clear();
+  testOffBar = false;
+  runBars(25);
+  static const int expected[] = { 3, 3, 5, 5, 5, 7, 5, 5 };
+  checkBars(expected, 8, 16, "slot 2 and two more bars of slot 1 are added to the song");
+  CHECK(!testOffBar);
+  CHECK(!songFlush);
+}
+
+////////////////////////////////////////////////////////
+// What was stored comes back after a restart
+static void testReload()
+{
+  songPlay(0);
+  songInit();
+  CHECK(4 == songChainLength);
+  CHECK(!SONG_EMPTY(0));
+  CHECK(!SONG_EMPTY(1));
+  CHECK(!SONG_EMPTY(2));
+  CHECK(!SONG_EMPTY(4));
+  CHECK(SONG_EMPTY(3));
+  CHECK(SONG_EMPTY(15));
+}
+
+////////////////////////////////////////////////////////
+int main()
+{
+  setup();
+  synchSetBPM(TEST_BPM);
+  testEmptySlot();
+  testSongPlays();
+  testEditWhilePlaying();
+  testReload();
+  CHECK(0 == hostEEPROMStalls);
+  return testResult("SongTest");
+}
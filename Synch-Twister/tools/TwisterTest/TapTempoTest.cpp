@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////
+//
+// T A P   T E M P O   T E S T
+//
+// Feeds tap sequences to CTapTempo: steady taps, taps with
+// timing jitter, a single fumbled tap, and a pause long
+// enough to start a new sequence
+//
+// Build from this folder with
+//
+//   g++ -std=c++11 -Wall -I../HostArduino -I../../Synch_Twister TapTempoTest.cpp -o tap-tempo-test
+//
+////////////////////////////////////////////////////////
+#include "TwisterTest.h"
+
+#include "Arduino.h"
+#include "TapTempo.h"
+
+////////////////////////////////////////////////////////
+// Nothing is reported until the third tap
+static void testLockOnThirdTap()
+{
+  CTapTempo tapTempo;
+  double bpm = 0;
+  CHECK(!tapTempo.tap(1000, &bpm));
+  CHECK(!tapTempo.tap(1500, &bpm));
+  CHECK(tapTempo.tap(2000, &bpm));
+  CHECK_NEAR(bpm, 120.0, 0.001);
+}
+
+////////////////////////////////////////////////////////
+// Taps up to 15ms either side of a 500ms beat
+static void testJitter()
+{
+  static const int jitter[] = { 0, 12, -9, 15, -14, 6, -11, 8, -3, 14, -15, 5, 10, -7, 2, -12 };
+  const int numTaps = sizeof(jitter)/sizeof(jitter[0]);
+  CTapTempo tapTempo;
+  for(int i = 0; i < numTaps; ++i)
+  {
+    double bpm = 0;
+    byte locked = tapTempo.tap(10000 + 500*i + jitter[i], &bpm);
+    if(i < TAP_MIN_TAPS - 1)
+    {
+      CHECK(!locked);
+    }
+    else
+    {
+      // the jitter is averaged over at least two intervals
+      CHECK(locked);
+      CHECK_NEAR(bpm, 120.0, 1.5);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////
+// One tap 150ms late among steady ones does not move the tempo
+static void testOutlier()
+{
+  CTapTempo tapTempo;
+  double bpm = 0;
+  unsigned long t = 5000;
+  for(int i = 0; i < 5; ++i, t += 500)
+    tapTempo.tap(t, &bpm);
+  CHECK(tapTempo.tap(t + 150, &bpm));
+  CHECK_NEAR(bpm, 120.0, 0.001);
+  t += 500;
+  for(int i = 0; i < 4; ++i, t += 500)
+  {
+    CHECK(tapTempo.tap(t, &bpm));
+    CHECK_NEAR(bpm, 120.0, 0.001);
+  }
+}
+
+////////////////////////////////////////////////////////
+// A pause longer than TAP_TIMEOUT_MS starts a new sequence,
+// which has to lock again and owes nothing to the old one
+static void testTimeout()
+{
+  CTapTempo tapTempo;
+  double bpm = 0;
+  unsigned long t = 1000;
+  for(int i = 0; i < 6; ++i, t += 500)
+    tapTempo.tap(t, &bpm);
+  CHECK_NEAR(bpm, 120.0, 0.001);
+
+  t += TAP_TIMEOUT_MS;
+  CHECK(!tapTempo.tap(t, &bpm));
+  CHECK(!tapTempo.tap(t + 400, &bpm));
+  CHECK(tapTempo.tap(t + 800, &bpm));
+  CHECK_NEAR(bpm, 150.0, 0.001);
+
+  // a pause of exactly the timeout carries on the sequence
+  t += 800 + TAP_TIMEOUT_MS;
+  CHECK(tapTempo.tap(t, &bpm));
+}
+
+////////////////////////////////////////////////////////
+int main()
+{
+  testLockOnThirdTap();
+  testJitter();
+  testOutlier();
+  testTimeout();
+  return testResult("TapTempoTest");
+}
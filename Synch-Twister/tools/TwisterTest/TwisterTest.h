@@ -0,0 +1,50 @@
+////////////////////////////////////////////////////////
+//
+// Checks shared by the host tests. A failed check prints
+// where it failed and carries on, and the test exits with
+// a non-zero status if anything failed
+//
+////////////////////////////////////////////////////////
+#ifndef TWISTER_TEST_H
+#define TWISTER_TEST_H
+
+#include <stdio.h>
+#include <math.h>
+
+static int testChecks;
+static int testFailures;
+
+#define CHECK(cond) testCheck((cond), #cond, __FILE__, __LINE__)
+#define CHECK_NEAR(a, b, tolerance) testCheckNear((a), (b), (tolerance), #a, __FILE__, __LINE__)
+
+////////////////////////////////////////////////////////
+static inline void testCheck(bool ok, const char *what, const char *file, int line)
+{
+  ++testChecks;
+  if(!ok)
+  {
+    ++testFailures;
+    printf("%s:%d: FAILED %s\n", file, line, what);
+  }
+}
+
+////////////////////////////////////////////////////////
+static inline void testCheckNear(double a, double b, double tolerance, const char *what, const char *file, int line)
+{
+  ++testChecks;
+  if(fabs(a - b) > tolerance)
+  {
+    ++testFailures;
+    printf("%s:%d: FAILED %s is %g, expected %g (+/-%g)\n", file, line, what, a, b, tolerance);
+  }
+}
+
+////////////////////////////////////////////////////////
+// Report and return the exit status for main()
+static inline int testResult(const char *name)
+{
+  printf("%s: %d checks, %d failed\n", name, testChecks, testFailures);
+  return testFailures? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+# Build and run the host tests. Run from this folder
+#
+set -e
+mkdir -p build
+SKETCH="../HostArduino/HostArduino.cpp ../../Synch_Twister/TinyUI.cpp ../../Synch_Twister/Health.cpp"
+FLAGS="-std=c++11 -Wall -Wno-int-to-pointer-cast -I../HostArduino -I../../Synch_Twister"
+
+g++ $FLAGS TapTempoTest.cpp -o build/tap-tempo-test
+g++ $FLAGS ChannelTest.cpp ../HostArduino/HostArduino.cpp -o build/channel-test
+g++ $FLAGS RampTest.cpp $SKETCH -o build/ramp-test
+g++ $FLAGS SongTest.cpp $SKETCH -o build/song-test
+g++ $FLAGS LinkTest.cpp $SKETCH -lutil -o build/link-test
+
+./build/tap-tempo-test
+./build/channel-test
+./build/ramp-test
+./build/song-test
+./build/link-test